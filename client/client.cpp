@@ -6,6 +6,8 @@
  */
 
 #define USE_IPV6 true
+#define PREFER_ENVELOPE true //Send AES-128-CBC envelopes when the server accepts them instead of RSA per block
+#define PREFER_BINARY true //Send binary messages when the server reads them instead of decimal text
 
 #if defined _WIN32
 #include <winsock2.h>
@@ -21,6 +23,7 @@ WSADATA wsadata;
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/select.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <iostream>
@@ -29,11 +32,17 @@ WSADATA wsadata;
 #include <boost/multiprecision/cpp_int.hpp>
 #include <vector>
 #include <string>
-#include <sstream>
+#include <algorithm>
 #include <random>
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_int_distribution.hpp>
 #include "rsa_cbc.h"
+#include "rsa_engine.h"
+#include "protocol.h"
+#include "envelope.h"
+#include "cbc_stream.h"
+#include "csprng.h"
+#include "framing.h"
 
 using namespace boost::multiprecision;
 using namespace boost::random;
@@ -143,8 +152,10 @@ int main(int argc, char *argv[]) {
 
     // Parse public key
     std::string public_key(buffer);
-    size_t delimiter_pos = public_key.find('|');
-    if (delimiter_pos == std::string::npos) {
+    cpp_int e, n;
+    std::unique_ptr<RsaEngineBase> engine;
+    if (parse_public_key(public_key, e, n)) engine = make_rsa_engine(e, n);
+    if (!engine) {
         cout << "Invalid public key format.\n";
 #if defined _WIN32
         closesocket(s);
@@ -154,12 +165,57 @@ int main(int argc, char *argv[]) {
 #endif
         return 1;
     }
-    std::string e_str = public_key.substr(0, delimiter_pos);
-    std::string n_str = public_key.substr(delimiter_pos + 1);
-    cpp_int e(e_str);
-    cpp_int n(n_str);
+    CbcCodebook codebook = make_cbc_codebook(*engine);
     cout << "Received public key: e = " << e << ", n = " << n << "\n";
 
+    // Ask which modes and formats the server supports. A server of the original protocol never answers, and
+    // expects what the original client sent: byte-mode decimal text, one message per send() with no newline
+    auto wait_readable = [&](int timeout_ms) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(s, &readable);
+        struct timeval timeout;
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_usec = (timeout_ms % 1000) * 1000;
+        return select(static_cast<int>(s) + 1, &readable, nullptr, nullptr, &timeout) > 0;
+    };
+    std::vector<CbcMode> modes{CbcMode::Byte};
+    std::vector<WireFormat> formats{WireFormat::Text};
+    FrameReader responses;
+    std::string request = std::string(CAPABILITY_REQUEST) + "\n";
+    bool legacy = true;
+    if (send(s, request.c_str(), request.size(), 0) == static_cast<int>(request.size())) {
+        FrameEvent event = responses.next();
+        while (event == FrameEvent::NeedMore && wait_readable(CAPABILITY_TIMEOUT_MS)) {
+            bytes = recv(s, buffer, BUFFER_SIZE, 0);
+            if (bytes <= 0) break;
+            responses.feed(std::string_view(buffer, bytes));
+            event = responses.next();
+        }
+        legacy = !(event == FrameEvent::Text && parse_capabilities(responses.text(), modes, formats));
+    }
+    if (legacy) cout << "Server did not answer the capability request; using the original protocol\n";
+
+    // Use envelope mode when preferred and supported, otherwise packed mode when the server supports it,
+    // and segmented mode for messages longer than one segment
+    CbcMode mode = CbcMode::Byte;
+    bool segmented = false, envelope = false;
+    for (CbcMode m : modes) {
+        if (m == CbcMode::Packed) mode = CbcMode::Packed;
+        if (m == CbcMode::Segmented) segmented = true;
+        if (m == CbcMode::Envelope) envelope = PREFER_ENVELOPE;
+    }
+    if (envelope) mode = CbcMode::Envelope;
+    segmented = segmented && mode == CbcMode::Packed;
+    bool binary = PREFER_BINARY && std::find(formats.begin(), formats.end(), WireFormat::Binary) != formats.end();
+    cout << "Using " << (mode == CbcMode::Envelope ? "envelope" : mode == CbcMode::Packed ? "packed" : "byte") << " mode"
+         << (segmented ? ", segmented for long messages" : "") << (binary ? ", binary messages" : "") << "\n";
+
+    // Reused for every message, so only a message longer than all before it allocates
+    std::vector<cpp_int> encrypted_message;
+    std::string send_str;
+    std::size_t modulus_bytes = wire_bytes(n);
+
     while (true){
         cout << "Enter message (or '.' to quit): ";
         std::string message;
@@ -167,24 +223,37 @@ int main(int argc, char *argv[]) {
         if (message == ".") break;
 
         // Generate random nonce
-        mt19937_64 gen(std::random_device{}());
         uniform_int_distribution<cpp_int> dis(1, n - 1);
-        cpp_int nonce = dis(gen);
+        cpp_int nonce = dis(thread_rng());
 
         // Encrypt nonce with server's public key
-        cpp_int encrypted_nonce = rsa_encrypt(nonce, e, n);
+        cpp_int encrypted_nonce = engine->encrypt(nonce);
 
         // Encrypt message using RSA-CBC with nonce as IV
-        std::vector<cpp_int> encrypted_message = cbc_encrypt(message, e, n, nonce);
-        std::stringstream send_data;
-        send_data << encrypted_nonce.str() << "|";
-        for (size_t i = 0; i < encrypted_message.size(); ++i){
-            send_data << encrypted_message[i].str();
-            if (i < encrypted_message.size() - 1) send_data << ",";
+        CbcMode message_mode = mode;
+        if (segmented && engine->packed_cipher_blocks(message.size()) > CBC_SEGMENT_BLOCKS) message_mode = CbcMode::Segmented;
+        CbcEncryptor encryptor(*engine, message_mode, nonce, &codebook);
+        encrypted_message = encryptor.update(message);
+        std::vector<cpp_int> last_blocks = encryptor.finish();
+        encrypted_message.insert(encrypted_message.end(), last_blocks.begin(), last_blocks.end());
+        if (binary) {
+            std::size_t block_bytes = message_mode == CbcMode::Envelope ? AES_BLOCK_BYTES : modulus_bytes;
+            if (!format_binary_message(message_mode, encrypted_nonce, encrypted_message, modulus_bytes, block_bytes, send_str)) {
+                cout << "Message could not be encoded; not sent.\n";
+                continue;
+            }
+        } else {
+            send_str = format_message(message_mode, encrypted_nonce, encrypted_message);
+            if (!legacy) send_str += '\n'; // ends the text frame
+        }
+        // send() may take only part of a long message
+        std::size_t sent = 0;
+        bytes = 0;
+        while (sent < send_str.size()) {
+            bytes = send(s, send_str.c_str() + sent, send_str.size() - sent, 0);
+            if (bytes <= 0) break;
+            sent += bytes;
         }
-
-        std::string send_str = send_data.str();
-        bytes = send(s, send_str.c_str(), send_str.size(), 0);
         if (bytes <= 0) {
 #if defined _WIN32
             std::cerr << "send failed: " << WSAGetLastError() << "\n";
@@ -195,10 +264,15 @@ int main(int argc, char *argv[]) {
         }
         cout << "Message sent.\n";
 
-        // Receive and display the response
-        memset(buffer, 0, BUFFER_SIZE);
-        bytes = recv(s, buffer, BUFFER_SIZE - 1, 0);
-        if (bytes <= 0) {
+        // Receive and display the response, a text line that may arrive in several pieces
+        FrameEvent event = responses.next();
+        while (event == FrameEvent::NeedMore) {
+            bytes = recv(s, buffer, BUFFER_SIZE, 0);
+            if (bytes <= 0) break;
+            responses.feed(std::string_view(buffer, bytes));
+            event = responses.next();
+        }
+        if (event != FrameEvent::Text) {
 #if defined _WIN32
             std::cerr << "recv failed: " << WSAGetLastError() << "\n";
 #else
@@ -206,8 +280,7 @@ int main(int argc, char *argv[]) {
 #endif
             break;
         }
-        buffer[bytes] = '\0';
-        cout << "Server response: " << buffer << "\n";
+        cout << "Server response: " << responses.text() << "\n";
     }
 
     cout << "Shutting down...\n";
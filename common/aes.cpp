@@ -0,0 +1,345 @@
+/*
+ *  File: aes.cpp
+ * Author: Johnny CW
+ * Date: October 16, 2026
+ * AES-128 in CBC mode, the symmetric half of the envelope mode: a portable implementation and an AES-NI one
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include "aes.h"
+
+#if (defined __GNUC__ || defined __clang__) && defined __x86_64__
+#define HAVE_AES_NI_KERNEL 1
+#include <immintrin.h>
+#define AES_NI_TARGET __attribute__((target("aes,sse2")))
+#else
+#define HAVE_AES_NI_KERNEL 0
+#endif
+
+namespace {
+
+constexpr std::uint8_t SBOX[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+constexpr std::array<std::uint8_t, 256> make_inverse_sbox(){
+    std::array<std::uint8_t, 256> inv{};
+    for (int i = 0; i < 256; ++i) inv[SBOX[i]] = static_cast<std::uint8_t>(i);
+    return inv;
+}
+
+constexpr std::array<std::uint8_t, 256> INV_SBOX = make_inverse_sbox();
+
+// Multiplication by x in GF(2^8) modulo x^8 + x^4 + x^3 + x + 1
+inline std::uint8_t xtime(std::uint8_t a){
+    return static_cast<std::uint8_t>((a << 1) ^ ((a & 0x80) ? 0x1b : 0));
+}
+
+// The state is 16 bytes in column order: byte r + 4c is row r of column c
+void add_round_key(std::uint8_t* s, const std::uint8_t* k){
+    for (std::size_t i = 0; i < AES_BLOCK_BYTES; ++i) s[i] ^= k[i];
+}
+
+void sub_shift_rows(std::uint8_t* s){
+    std::uint8_t t[AES_BLOCK_BYTES];
+    for (int c = 0; c < 4; ++c)
+        for (int r = 0; r < 4; ++r) t[r + 4 * c] = SBOX[s[r + 4 * ((c + r) % 4)]];
+    std::memcpy(s, t, AES_BLOCK_BYTES);
+}
+
+void inv_sub_shift_rows(std::uint8_t* s){
+    std::uint8_t t[AES_BLOCK_BYTES];
+    for (int c = 0; c < 4; ++c)
+        for (int r = 0; r < 4; ++r) t[r + 4 * ((c + r) % 4)] = INV_SBOX[s[r + 4 * c]];
+    std::memcpy(s, t, AES_BLOCK_BYTES);
+}
+
+void mix_columns(std::uint8_t* s){
+    for (int c = 0; c < 4; ++c){
+        std::uint8_t* a = s + 4 * c;
+        std::uint8_t all = a[0] ^ a[1] ^ a[2] ^ a[3];
+        std::uint8_t a0 = a[0];
+        a[0] ^= all ^ xtime(a[0] ^ a[1]);
+        a[1] ^= all ^ xtime(a[1] ^ a[2]);
+        a[2] ^= all ^ xtime(a[2] ^ a[3]);
+        a[3] ^= all ^ xtime(a[3] ^ a0);
+    }
+}
+
+// InvMixColumns as a preprocessing step followed by MixColumns, which avoids general GF(2^8) multiplications
+void inv_mix_columns(std::uint8_t* s){
+    for (int c = 0; c < 4; ++c){
+        std::uint8_t* a = s + 4 * c;
+        std::uint8_t u = xtime(xtime(a[0] ^ a[2]));
+        std::uint8_t v = xtime(xtime(a[1] ^ a[3]));
+        a[0] ^= u;
+        a[1] ^= v;
+        a[2] ^= u;
+        a[3] ^= v;
+    }
+    mix_columns(s);
+}
+
+void portable_encrypt(const Aes128Key& key, const std::uint8_t* in, std::uint8_t* out){
+    std::uint8_t s[AES_BLOCK_BYTES];
+    std::memcpy(s, in, AES_BLOCK_BYTES);
+    add_round_key(s, key.enc.data());
+    for (std::size_t round = 1; round < AES128_ROUNDS; ++round){
+        sub_shift_rows(s);
+        mix_columns(s);
+        add_round_key(s, key.enc.data() + AES_BLOCK_BYTES * round);
+    }
+    sub_shift_rows(s);
+    add_round_key(s, key.enc.data() + AES_BLOCK_BYTES * AES128_ROUNDS);
+    std::memcpy(out, s, AES_BLOCK_BYTES);
+}
+
+void portable_decrypt(const Aes128Key& key, const std::uint8_t* in, std::uint8_t* out){
+    std::uint8_t s[AES_BLOCK_BYTES];
+    std::memcpy(s, in, AES_BLOCK_BYTES);
+    add_round_key(s, key.enc.data() + AES_BLOCK_BYTES * AES128_ROUNDS);
+    for (std::size_t round = AES128_ROUNDS - 1; round > 0; --round){
+        inv_sub_shift_rows(s);
+        add_round_key(s, key.enc.data() + AES_BLOCK_BYTES * round);
+        inv_mix_columns(s);
+    }
+    inv_sub_shift_rows(s);
+    add_round_key(s, key.enc.data());
+    std::memcpy(out, s, AES_BLOCK_BYTES);
+}
+
+void portable_cbc_encrypt(const Aes128Key& key, const std::uint8_t* iv, const std::uint8_t* in, std::uint8_t* out,
+                          std::size_t blocks){
+    const std::uint8_t* prev = iv;
+    for (std::size_t b = 0; b < blocks; ++b){
+        std::uint8_t x[AES_BLOCK_BYTES];
+        for (std::size_t i = 0; i < AES_BLOCK_BYTES; ++i) x[i] = in[b * AES_BLOCK_BYTES + i] ^ prev[i];
+        portable_encrypt(key, x, out + b * AES_BLOCK_BYTES);
+        prev = out + b * AES_BLOCK_BYTES;
+    }
+}
+
+void portable_cbc_decrypt(const Aes128Key& key, const std::uint8_t* iv, const std::uint8_t* in, std::uint8_t* out,
+                          std::size_t blocks){
+    for (std::size_t b = 0; b < blocks; ++b){
+        const std::uint8_t* prev = b == 0 ? iv : in + (b - 1) * AES_BLOCK_BYTES;
+        std::uint8_t x[AES_BLOCK_BYTES];
+        portable_decrypt(key, in + b * AES_BLOCK_BYTES, x);
+        for (std::size_t i = 0; i < AES_BLOCK_BYTES; ++i) out[b * AES_BLOCK_BYTES + i] = x[i] ^ prev[i];
+    }
+}
+
+
+#if HAVE_AES_NI_KERNEL
+/*
+ * AES-NI Kernel
+ *
+ * One aesenc/aesdec instruction per round. CBC encryption cannot overlap blocks, since each one needs the previous
+ * ciphertext, but decryption keeps four independent blocks in flight to hide the instruction latency.
+ */
+AES_NI_TARGET void ni_cbc_encrypt(const Aes128Key& key, const std::uint8_t* iv, const std::uint8_t* in, std::uint8_t* out,
+                                  std::size_t blocks){
+    __m128i rk[AES128_ROUNDS + 1];
+    for (std::size_t r = 0; r <= AES128_ROUNDS; ++r) rk[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key.enc.data() + 16 * r));
+    __m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv));
+    for (std::size_t b = 0; b < blocks; ++b){
+        __m128i x = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 16 * b)), prev);
+        x = _mm_xor_si128(x, rk[0]);
+        for (std::size_t r = 1; r < AES128_ROUNDS; ++r) x = _mm_aesenc_si128(x, rk[r]);
+        prev = _mm_aesenclast_si128(x, rk[AES128_ROUNDS]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * b), prev);
+    }
+}
+
+AES_NI_TARGET void ni_cbc_decrypt(const Aes128Key& key, const std::uint8_t* iv, const std::uint8_t* in, std::uint8_t* out,
+                                  std::size_t blocks){
+    __m128i rk[AES128_ROUNDS + 1];
+    for (std::size_t r = 0; r <= AES128_ROUNDS; ++r) rk[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key.dec.data() + 16 * r));
+    __m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv));
+    std::size_t b = 0;
+    for (; b + 4 <= blocks; b += 4){
+        __m128i c[4], x[4];
+        for (int l = 0; l < 4; ++l){
+            c[l] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 16 * (b + l)));
+            x[l] = _mm_xor_si128(c[l], rk[0]);
+        }
+        for (std::size_t r = 1; r < AES128_ROUNDS; ++r)
+            for (int l = 0; l < 4; ++l) x[l] = _mm_aesdec_si128(x[l], rk[r]);
+        for (int l = 0; l < 4; ++l){
+            x[l] = _mm_aesdeclast_si128(x[l], rk[AES128_ROUNDS]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * (b + l)), _mm_xor_si128(x[l], l == 0 ? prev : c[l - 1]));
+        }
+        prev = c[3];
+    }
+    for (; b < blocks; ++b){
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 16 * b));
+        __m128i x = _mm_xor_si128(c, rk[0]);
+        for (std::size_t r = 1; r < AES128_ROUNDS; ++r) x = _mm_aesdec_si128(x, rk[r]);
+        x = _mm_aesdeclast_si128(x, rk[AES128_ROUNDS]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * b), _mm_xor_si128(x, prev));
+        prev = c;
+    }
+}
+#endif
+
+void cbc_encrypt_blocks(const Aes128Key& key, const std::uint8_t* iv, const std::uint8_t* in, std::uint8_t* out,
+                        std::size_t blocks){
+#if HAVE_AES_NI_KERNEL
+    if (aes_ni_available()) return ni_cbc_encrypt(key, iv, in, out, blocks);
+#endif
+    portable_cbc_encrypt(key, iv, in, out, blocks);
+}
+
+void cbc_decrypt_blocks(const Aes128Key& key, const std::uint8_t* iv, const std::uint8_t* in, std::uint8_t* out,
+                        std::size_t blocks){
+#if HAVE_AES_NI_KERNEL
+    if (aes_ni_available()) return ni_cbc_decrypt(key, iv, in, out, blocks);
+#endif
+    portable_cbc_decrypt(key, iv, in, out, blocks);
+}
+
+} // namespace
+
+
+bool aes_ni_available(){
+#if HAVE_AES_NI_KERNEL
+    static const bool available = __builtin_cpu_supports("aes");
+    return available;
+#else
+    return false;
+#endif
+}
+
+
+/*
+ * AES-128 Key Expansion
+ *
+ * Variables:
+ * enc: the 11 round keys of FIPS-197, 44 words, each word built from the one before and the one four back
+ * dec: the round keys in reverse with InvMixColumns applied to the middle nine, the layout aesdec expects
+ *
+ * Purpose:
+ * Done once per message, so every block reuses the same schedule.
+ */
+Aes128Key make_aes128_key(const std::uint8_t* key){
+    Aes128Key k;
+    std::copy(key, key + AES128_KEY_BYTES, k.enc.begin());
+    std::uint8_t rcon = 1;
+    for (std::size_t i = 4; i < 4 * (AES128_ROUNDS + 1); ++i){
+        std::uint8_t t[4];
+        std::copy(k.enc.begin() + 4 * (i - 1), k.enc.begin() + 4 * i, t);
+        if (i % 4 == 0){
+            std::uint8_t t0 = t[0];
+            t[0] = SBOX[t[1]] ^ rcon;
+            t[1] = SBOX[t[2]];
+            t[2] = SBOX[t[3]];
+            t[3] = SBOX[t0];
+            rcon = xtime(rcon);
+        }
+        for (int j = 0; j < 4; ++j) k.enc[4 * i + j] = k.enc[4 * (i - 4) + j] ^ t[j];
+    }
+
+    for (std::size_t r = 0; r <= AES128_ROUNDS; ++r){
+        std::uint8_t* d = k.dec.data() + AES_BLOCK_BYTES * r;
+        std::copy_n(k.enc.data() + AES_BLOCK_BYTES * (AES128_ROUNDS - r), AES_BLOCK_BYTES, d);
+        if (r != 0 && r != AES128_ROUNDS) inv_mix_columns(d);
+    }
+    return k;
+}
+
+AesBlock aes128_encrypt_block(const Aes128Key& key, const AesBlock& in){
+    AesBlock out;
+    portable_encrypt(key, in.data(), out.data());
+    return out;
+}
+
+AesBlock aes128_decrypt_block(const Aes128Key& key, const AesBlock& in){
+    AesBlock out;
+    portable_decrypt(key, in.data(), out.data());
+    return out;
+}
+
+
+/*
+ * AES-CBC with PKCS#7 padding
+ *
+ * Variables:
+ * pad: 1..16 bytes, each holding the pad length; always added, so a full final block gets a whole padding block
+ * out: caller buffer of at least aes_cbc_cipher_bytes(plaintext.size()) bytes, or cipher.size() bytes to decrypt
+ *
+ * Purpose:
+ * aes_cbc_encrypt returns the number of bytes written, or 0 if out is too small.
+ * aes_cbc_decrypt sets length to the size without the padding and returns false if the cipher is not a whole number
+ * of blocks, out is too small or the padding is invalid.
+ * aes_cbc_decrypt_blocks decrypts whole blocks without looking at padding and leaves the last cipher block in iv,
+ * so a message can be decrypted a piece at a time; pkcs7_unpadded_size then checks the final block.
+ */
+std::size_t aes_cbc_cipher_bytes(std::size_t plaintext_bytes){
+    return (plaintext_bytes / AES_BLOCK_BYTES + 1) * AES_BLOCK_BYTES;
+}
+
+std::size_t aes_cbc_encrypt(const Aes128Key& key, const AesBlock& iv, std::string_view plaintext, std::span<std::uint8_t> out){
+    std::size_t total = aes_cbc_cipher_bytes(plaintext.size());
+    if (out.size() < total) return 0;
+    std::size_t whole = plaintext.size() / AES_BLOCK_BYTES;
+    cbc_encrypt_blocks(key, iv.data(), reinterpret_cast<const std::uint8_t*>(plaintext.data()), out.data(), whole);
+
+    std::uint8_t last[AES_BLOCK_BYTES];
+    std::size_t tail = plaintext.size() - whole * AES_BLOCK_BYTES;
+    std::copy_n(plaintext.data() + whole * AES_BLOCK_BYTES, tail, last);
+    std::fill(last + tail, last + AES_BLOCK_BYTES, static_cast<std::uint8_t>(AES_BLOCK_BYTES - tail));
+    const std::uint8_t* prev = whole == 0 ? iv.data() : out.data() + (whole - 1) * AES_BLOCK_BYTES;
+    cbc_encrypt_blocks(key, prev, last, out.data() + whole * AES_BLOCK_BYTES, 1);
+    return total;
+}
+
+bool aes_cbc_decrypt(const Aes128Key& key, const AesBlock& iv, std::span<const std::uint8_t> cipher, std::span<char> out,
+                     std::size_t& length){
+    length = 0;
+    if (cipher.empty() || cipher.size() % AES_BLOCK_BYTES != 0 || out.size() < cipher.size()) return false;
+    std::uint8_t* dst = reinterpret_cast<std::uint8_t*>(out.data());
+    cbc_decrypt_blocks(key, iv.data(), cipher.data(), dst, cipher.size() / AES_BLOCK_BYTES);
+
+    std::size_t unpadded = pkcs7_unpadded_size(std::span<const std::uint8_t>(dst, cipher.size()));
+    if (unpadded == static_cast<std::size_t>(-1)) return false;
+    length = unpadded;
+    return true;
+}
+
+std::size_t aes_cbc_decrypt_blocks(const Aes128Key& key, AesBlock& iv, std::span<const std::uint8_t> cipher,
+                                   std::span<std::uint8_t> out){
+    if (cipher.size() % AES_BLOCK_BYTES != 0 || out.size() < cipher.size()) return 0;
+    if (cipher.empty()) return 0;
+    cbc_decrypt_blocks(key, iv.data(), cipher.data(), out.data(), cipher.size() / AES_BLOCK_BYTES);
+    std::copy_n(cipher.data() + cipher.size() - AES_BLOCK_BYTES, AES_BLOCK_BYTES, iv.begin());
+    return cipher.size();
+}
+
+// Size of data without its PKCS#7 padding, or size_t(-1) if it does not end in valid padding
+std::size_t pkcs7_unpadded_size(std::span<const std::uint8_t> data){
+    if (data.empty()) return static_cast<std::size_t>(-1);
+    std::uint8_t pad = data.back();
+    if (pad == 0 || pad > AES_BLOCK_BYTES || pad > data.size()) return static_cast<std::size_t>(-1);
+    for (std::size_t i = data.size() - pad; i < data.size(); ++i){
+        if (data[i] != pad) return static_cast<std::size_t>(-1);
+    }
+    return data.size() - pad;
+}
@@ -0,0 +1,35 @@
+#ifndef AES_H
+#define AES_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+constexpr std::size_t AES_BLOCK_BYTES = 16;
+constexpr std::size_t AES128_KEY_BYTES = 16;
+constexpr std::size_t AES128_ROUNDS = 10;
+
+using AesBlock = std::array<std::uint8_t, AES_BLOCK_BYTES>;
+
+// Expanded AES-128 key, built once per message
+struct Aes128Key {
+    std::array<std::uint8_t, AES_BLOCK_BYTES * (AES128_ROUNDS + 1)> enc; // round keys 0..10
+    std::array<std::uint8_t, AES_BLOCK_BYTES * (AES128_ROUNDS + 1)> dec; // equivalent inverse cipher keys for AES-NI
+};
+
+bool aes_ni_available();
+Aes128Key make_aes128_key(const std::uint8_t* key);
+AesBlock aes128_encrypt_block(const Aes128Key& key, const AesBlock& in);
+AesBlock aes128_decrypt_block(const Aes128Key& key, const AesBlock& in);
+
+std::size_t aes_cbc_cipher_bytes(std::size_t plaintext_bytes);
+std::size_t aes_cbc_encrypt(const Aes128Key& key, const AesBlock& iv, std::string_view plaintext, std::span<std::uint8_t> out);
+bool aes_cbc_decrypt(const Aes128Key& key, const AesBlock& iv, std::span<const std::uint8_t> cipher, std::span<char> out,
+                     std::size_t& length);
+std::size_t aes_cbc_decrypt_blocks(const Aes128Key& key, AesBlock& iv, std::span<const std::uint8_t> cipher,
+                                   std::span<std::uint8_t> out);
+std::size_t pkcs7_unpadded_size(std::span<const std::uint8_t> data);
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ *  File: cbc_stream.cpp
+ * Author: Johnny CW
+ * Date: October 16, 2026
+ * Incremental CBC encryption and decryption for messages that arrive or leave in pieces
+ */
+
+#include "cbc_stream.h"
+
+CbcEncryptor::CbcEncryptor(const RsaEngineBase& engine, CbcMode mode, const cpp_int& iv, const CbcCodebook* book)
+    : engine_(engine), mode_(mode), block_bytes_(engine.block_bytes()), prev_(iv), book_(book) {
+    if (mode_ == CbcMode::Segmented) nonce_ = iv;
+    if (mode_ == CbcMode::Envelope){
+        envelope_ = make_envelope_key(iv);
+        block_bytes_ = AES_BLOCK_BYTES;
+    }
+}
+
+/*
+ * Byte mode encrypts every byte straight away. The padded modes encrypt only whole blocks (segmented mode: whole
+ * segments, together on the shared pool) and keep the rest in pending_ for the next call.
+ */
+std::vector<cpp_int> CbcEncryptor::update(std::string_view chunk){
+    std::vector<cpp_int> cipher;
+    if (mode_ == CbcMode::Byte){
+        cipher.resize(cbc_cipher_blocks(chunk.size()));
+        if (book_) cbc_encrypt(chunk, *book_, prev_, cipher);
+        else engine_.cbc_encrypt(chunk, prev_, cipher);
+        if (!cipher.empty()) prev_ = cipher.back();
+        return cipher;
+    }
+
+    pending_.append(chunk);
+    std::size_t unit = mode_ == CbcMode::Segmented ? CBC_SEGMENT_BLOCKS * block_bytes_ : block_bytes_;
+    std::size_t whole = pending_.size() - pending_.size() % unit;
+    if (whole == 0) return cipher;
+    cipher.resize(whole / block_bytes_);
+    if (mode_ == CbcMode::Segmented){
+        engine_.cbc_encrypt_segments(std::string_view(pending_).substr(0, whole), nonce_, segment_, cipher);
+        segment_ += whole / unit;
+    } else if (mode_ == CbcMode::Envelope){
+        for (std::size_t b = 0; b < cipher.size(); ++b){
+            AesBlock x;
+            for (std::size_t i = 0; i < AES_BLOCK_BYTES; ++i) x[i] = static_cast<std::uint8_t>(pending_[b * AES_BLOCK_BYTES + i]) ^ envelope_.iv[i];
+            envelope_.iv = aes128_encrypt_block(envelope_.key, x);
+            import_bits(cipher[b], envelope_.iv.begin(), envelope_.iv.end(), 8, true);
+        }
+    } else {
+        engine_.cbc_encrypt_packed_blocks(std::string_view(pending_).substr(0, whole), prev_, cipher);
+        prev_ = cipher.back();
+    }
+    pending_.erase(0, whole);
+    return cipher;
+}
+
+// The padded modes pad what is left into the final block (segmented: the final segment); byte mode has nothing left to emit
+std::vector<cpp_int> CbcEncryptor::finish(){
+    std::vector<cpp_int> cipher;
+    if (mode_ == CbcMode::Byte) return cipher;
+    if (mode_ == CbcMode::Envelope){
+        AesBlock last;
+        aes_cbc_encrypt(envelope_.key, envelope_.iv, pending_, last);
+        envelope_.iv = last;
+        cipher.resize(1);
+        import_bits(cipher[0], last.begin(), last.end(), 8, true);
+    } else {
+        cipher.resize(engine_.packed_cipher_blocks(pending_.size()));
+        if (mode_ == CbcMode::Segmented){
+            engine_.cbc_encrypt_packed(pending_, segment_iv(nonce_, segment_, block_bytes_), cipher);
+            ++segment_;
+        } else {
+            engine_.cbc_encrypt_packed(pending_, prev_, cipher);
+        }
+        prev_ = cipher.back();
+    }
+    pending_.clear();
+    return cipher;
+}
+
+
+CbcDecryptor::CbcDecryptor(const RsaEngineBase& engine, CbcMode mode, const cpp_int& iv, const CbcDecryptIndex* index)
+    : engine_(engine), mode_(mode), block_bytes_(engine.block_bytes()), prev_(iv), index_(index) {
+    if (mode_ == CbcMode::Segmented) nonce_ = iv;
+    if (mode_ == CbcMode::Envelope){
+        envelope_ = make_envelope_key(iv);
+        block_bytes_ = AES_BLOCK_BYTES;
+    }
+}
+
+/*
+ * Each call decrypts its blocks as one batch, chained on the last block of the previous call.
+ * Segmented mode collects blocks until segments are complete, then decrypts every segment this call completed
+ * together, in parallel, each from its own IV.
+ */
+std::string CbcDecryptor::update(std::span<const cpp_int> blocks){
+    if (blocks.empty() || failed_) return std::string();
+    std::string plaintext;
+    if (mode_ == CbcMode::Byte && index_){
+        plaintext.resize(blocks.size());
+        unsigned prev = static_cast<unsigned>(prev_ & 0xff);
+        for (std::size_t i = 0; i < blocks.size(); ++i){
+            int hit = cbc_index_lookup(*index_, blocks[i]);
+            unsigned x = hit >= 0 ? static_cast<unsigned>(hit) : static_cast<unsigned>(engine_.decrypt(blocks[i]) & 0xff);
+            plaintext[i] = static_cast<char>(x ^ prev);
+            prev = static_cast<unsigned>(blocks[i] & 0xff);
+        }
+    } else if (mode_ == CbcMode::Byte){
+        plaintext.resize(cbc_plaintext_bytes(blocks.size()));
+        plaintext.resize(engine_.cbc_decrypt(blocks, prev_, plaintext));
+    } else if (mode_ == CbcMode::Segmented){
+        segment_blocks_.insert(segment_blocks_.end(), blocks.begin(), blocks.end());
+        std::size_t whole = segment_blocks_.size() - segment_blocks_.size() % CBC_SEGMENT_BLOCKS;
+        if (whole > 0) decrypt_segments(plaintext, whole);
+        return plaintext;
+    } else if (mode_ == CbcMode::Envelope){
+        std::vector<std::uint8_t> cipher(blocks.size() * AES_BLOCK_BYTES);
+        if (!envelope_cipher_bytes(blocks, cipher)){
+            failed_ = true;
+            return std::string();
+        }
+        plaintext = held_;
+        plaintext.resize(held_.size() + cipher.size());
+        aes_cbc_decrypt_blocks(envelope_.key, envelope_.iv, cipher,
+                               std::span<std::uint8_t>(reinterpret_cast<std::uint8_t*>(plaintext.data()) + held_.size(), cipher.size()));
+        held_.assign(plaintext, plaintext.size() - AES_BLOCK_BYTES, AES_BLOCK_BYTES);
+        plaintext.resize(plaintext.size() - AES_BLOCK_BYTES);
+        return plaintext;
+    } else {
+        plaintext = held_;
+        plaintext.resize(held_.size() + engine_.packed_plaintext_bytes(blocks.size()));
+        if (engine_.cbc_decrypt_packed_blocks(blocks, prev_, std::span<char>(plaintext).subspan(held_.size())) == 0){
+            failed_ = true; // engine without a private key
+            return std::string();
+        }
+        held_.assign(plaintext, plaintext.size() - block_bytes_, block_bytes_);
+        plaintext.resize(plaintext.size() - block_bytes_);
+    }
+    prev_ = blocks.back();
+    return plaintext;
+}
+
+// Decrypts the first count collected blocks (whole segments, or the final partial one), appending all of them but
+// the last block's plaintext, which goes to held_
+void CbcDecryptor::decrypt_segments(std::string& plaintext, std::size_t count){
+    std::size_t start = plaintext.size();
+    plaintext += held_;
+    plaintext.resize(start + held_.size() + engine_.packed_plaintext_bytes(count));
+    std::span<char> out = std::span<char>(plaintext).subspan(start + held_.size());
+    if (engine_.cbc_decrypt_segments(std::span<const cpp_int>(segment_blocks_).first(count), nonce_, segment_, out) == 0){
+        failed_ = true;
+    }
+    held_.assign(plaintext, plaintext.size() - block_bytes_, block_bytes_);
+    plaintext.resize(plaintext.size() - block_bytes_);
+    segment_blocks_.erase(segment_blocks_.begin(), segment_blocks_.begin() + count);
+    segment_ += (count + CBC_SEGMENT_BLOCKS - 1) / CBC_SEGMENT_BLOCKS;
+}
+
+bool CbcDecryptor::finish(std::string& tail){
+    tail.clear();
+    if (mode_ == CbcMode::Segmented && !segment_blocks_.empty()) decrypt_segments(tail, segment_blocks_.size());
+    if (failed_){
+        tail.clear();
+        return false;
+    }
+    if (mode_ == CbcMode::Byte) return true;
+    tail += held_;
+    held_.clear();
+    if (mode_ == CbcMode::Envelope){
+        std::size_t last = tail.size() - std::min(tail.size(), AES_BLOCK_BYTES);
+        std::size_t unpadded = pkcs7_unpadded_size(std::span<const std::uint8_t>(
+            reinterpret_cast<const std::uint8_t*>(tail.data()) + last, tail.size() - last));
+        if (unpadded != static_cast<std::size_t>(-1)){
+            tail.resize(last + unpadded);
+            return true;
+        }
+    } else if (packed_unpad(tail)){
+        return true;
+    }
+    tail.clear();
+    return false;
+}
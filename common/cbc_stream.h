@@ -0,0 +1,80 @@
+#ifndef CBC_STREAM_H
+#define CBC_STREAM_H
+
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <boost/multiprecision/cpp_int.hpp>
+#include "envelope.h"
+#include "protocol.h"
+#include "rsa_cbc.h"
+#include "rsa_engine.h"
+
+using namespace boost::multiprecision;
+
+/*
+ * Streaming CBC Encryptor
+ *
+ * Carries the chaining value between update() calls, so a message can be encrypted as it arrives. Every mode is
+ * supported: in segmented and envelope mode iv is the message nonce. The blocks from every update() followed by
+ * finish() are the same as one cbc_encrypt, cbc_encrypt_packed, cbc_encrypt_segmented or envelope_encrypt call on
+ * the whole message. With a codebook, byte mode looks blocks up in it instead of running RSA (see CbcCodebook).
+ * The engine and codebook must outlive the encryptor.
+ */
+class CbcEncryptor {
+public:
+    CbcEncryptor(const RsaEngineBase& engine, CbcMode mode, const cpp_int& iv, const CbcCodebook* book = nullptr);
+
+    std::vector<cpp_int> update(std::string_view chunk);
+    std::vector<cpp_int> finish();
+
+private:
+    const RsaEngineBase& engine_;
+    CbcMode mode_;
+    std::size_t block_bytes_;
+    cpp_int prev_;
+    std::string pending_; // padded modes: trailing bytes that do not fill a block (segmented: a segment) yet
+    const CbcCodebook* book_;
+    cpp_int nonce_;           // segmented mode
+    std::size_t segment_ = 0; // segmented mode: index of the next segment to encrypt
+    EnvelopeKey envelope_{};  // envelope mode: AES key, and the IV chained from block to block
+};
+
+/*
+ * Streaming CBC Decryptor
+ *
+ * The inverse of CbcEncryptor: update() takes ciphertext blocks in any grouping and returns the plaintext it can
+ * already release. It also reads the segmented and envelope modes (iv is then the message nonce), so a message of
+ * any mode and length can be decrypted as it arrives. In the padded modes the plaintext of the newest block is held
+ * back, because only finish() knows it is the last one and carries the padding. finish() returns false if the
+ * padding is invalid or a block could not be decrypted.
+ * Segmented mode decrypts all the segments one update() completes at once, in parallel, so passing it several
+ * segments per call uses several cores.
+ * With an index, byte mode looks blocks up in it instead of running RSA (see CbcDecryptIndex).
+ */
+class CbcDecryptor {
+public:
+    CbcDecryptor(const RsaEngineBase& engine, CbcMode mode, const cpp_int& iv, const CbcDecryptIndex* index = nullptr);
+
+    std::string update(std::span<const cpp_int> blocks);
+    bool finish(std::string& tail);
+
+private:
+    void decrypt_segments(std::string& plaintext, std::size_t count);
+
+    const RsaEngineBase& engine_;
+    CbcMode mode_;
+    std::size_t block_bytes_;
+    cpp_int prev_;
+    std::string held_; // padded modes: plaintext of the newest block
+    const CbcDecryptIndex* index_;
+    bool failed_ = false;
+    cpp_int nonce_;                       // segmented mode
+    std::size_t segment_ = 0;             // segmented mode: index of the first segment not decrypted yet
+    std::vector<cpp_int> segment_blocks_; // segmented mode: blocks received from that segment on
+    EnvelopeKey envelope_{};              // envelope mode: AES key, and the IV chained from block to block
+};
+
+#endif
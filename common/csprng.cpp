@@ -0,0 +1,160 @@
+/*
+ *  File: csprng.cpp
+ * Author: Johnny CW
+ * Date: October 16, 2026
+ * Thread-local ChaCha20 generator for primes, Miller-Rabin bases and message nonces
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include "csprng.h"
+
+#if defined __linux__
+#include <cerrno>
+#include <sys/random.h>
+#endif
+
+
+static std::uint32_t rotl32(std::uint32_t x, int n){
+    return (x << n) | (x >> (32 - n));
+}
+
+static void quarter_round(std::uint32_t& a, std::uint32_t& b, std::uint32_t& c, std::uint32_t& d){
+    a += b; d ^= a; d = rotl32(d, 16);
+    c += d; b ^= c; b = rotl32(b, 12);
+    a += b; d ^= a; d = rotl32(d, 8);
+    c += d; b ^= c; b = rotl32(b, 7);
+}
+
+/*
+ * ChaCha20 Block Function (RFC 8439)
+ *
+ * Variables:
+ * input: 4 constant words, 8 key words, then counter and nonce words
+ * out: 64 bytes of keystream, the words of (20 rounds of input) + input, little-endian
+ */
+void chacha20_block(const std::array<std::uint32_t, 16>& input, std::uint8_t* out){
+    std::array<std::uint32_t, 16> x = input;
+    for (int i = 0; i < 10; ++i){
+        quarter_round(x[0], x[4], x[8], x[12]);
+        quarter_round(x[1], x[5], x[9], x[13]);
+        quarter_round(x[2], x[6], x[10], x[14]);
+        quarter_round(x[3], x[7], x[11], x[15]);
+        quarter_round(x[0], x[5], x[10], x[15]);
+        quarter_round(x[1], x[6], x[11], x[12]);
+        quarter_round(x[2], x[7], x[8], x[13]);
+        quarter_round(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; ++i){
+        std::uint32_t v = x[i] + input[i];
+        out[4 * i] = static_cast<std::uint8_t>(v);
+        out[4 * i + 1] = static_cast<std::uint8_t>(v >> 8);
+        out[4 * i + 2] = static_cast<std::uint8_t>(v >> 16);
+        out[4 * i + 3] = static_cast<std::uint8_t>(v >> 24);
+    }
+}
+
+
+// Constant words and little-endian key words of a ChaCha20 input block; counter and nonce words left 0
+static std::array<std::uint32_t, 16> chacha20_input(const std::uint8_t* key){
+    std::array<std::uint32_t, 16> input = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+    for (int i = 0; i < 8; ++i){
+        input[4 + i] = std::uint32_t(key[4 * i]) | (std::uint32_t(key[4 * i + 1]) << 8)
+                     | (std::uint32_t(key[4 * i + 2]) << 16) | (std::uint32_t(key[4 * i + 3]) << 24);
+    }
+    return input;
+}
+
+/*
+ * ChaCha20 Keystream
+ *
+ * Variables:
+ * stream: 64-bit stream number, in the nonce words, so one key gives independent streams
+ *
+ * Purpose:
+ * The first out.size() bytes of the keystream of (key, stream), block counter from 0. As a PRF of the stream number
+ * under a secret key, it derives values both ends can compute and nobody without the key can predict.
+ */
+void chacha20_keystream(std::span<const std::uint8_t, CHACHA_KEY_BYTES> key, std::uint64_t stream, std::span<std::uint8_t> out){
+    std::array<std::uint32_t, 16> input = chacha20_input(key.data());
+    input[13] = static_cast<std::uint32_t>(stream);
+    input[14] = static_cast<std::uint32_t>(stream >> 32);
+    std::uint8_t block[CHACHA_BLOCK_BYTES];
+    for (std::size_t done = 0, b = 0; done < out.size(); done += CHACHA_BLOCK_BYTES, ++b){
+        input[12] = static_cast<std::uint32_t>(b);
+        chacha20_block(input, block);
+        std::memcpy(out.data() + done, block, std::min(CHACHA_BLOCK_BYTES, out.size() - done));
+    }
+}
+
+
+// Fills out from the operating system's generator; std::random_device where there is no getrandom()
+static void os_random(std::uint8_t* out, std::size_t n){
+#if defined __linux__
+    while (n > 0){
+        ssize_t got = getrandom(out, n, 0);
+        if (got < 0){
+            if (errno == EINTR) continue;
+            break; // fall through to random_device for the rest
+        }
+        out += got;
+        n -= static_cast<std::size_t>(got);
+    }
+#endif
+    std::random_device device;
+    for (; n > 0; ){
+        std::uint32_t v = device();
+        std::size_t take = std::min<std::size_t>(n, sizeof(v));
+        std::memcpy(out, &v, take);
+        out += take;
+        n -= take;
+    }
+}
+
+
+ChaChaRng::ChaChaRng(){
+    os_random(key_.data(), key_.size());
+}
+
+/*
+ * Runs ChaCha20 with the current key and a zero nonce over counters 0..CHACHA_BUFFER_BLOCKS-1. The key never
+ * encrypts more than one buffer, so the counter can restart at 0 every time.
+ */
+void ChaChaRng::refill(){
+    std::array<std::uint32_t, 16> input = chacha20_input(key_.data());
+    for (std::size_t b = 0; b < CHACHA_BUFFER_BLOCKS; ++b){
+        input[12] = static_cast<std::uint32_t>(b);
+        chacha20_block(input, buffer_.data() + b * CHACHA_BLOCK_BYTES);
+    }
+    std::memcpy(key_.data(), buffer_.data(), CHACHA_KEY_BYTES);
+    std::memset(buffer_.data(), 0, CHACHA_KEY_BYTES);
+    used_ = CHACHA_KEY_BYTES;
+}
+
+ChaChaRng::result_type ChaChaRng::operator()(){
+    if (buffer_.size() - used_ < sizeof(result_type)) refill();
+    result_type v;
+    std::memcpy(&v, buffer_.data() + used_, sizeof(v));
+    std::memset(buffer_.data() + used_, 0, sizeof(v));
+    used_ += sizeof(v);
+    return v;
+}
+
+void ChaChaRng::fill(std::span<std::uint8_t> out){
+    std::size_t done = 0;
+    while (done < out.size()){
+        if (used_ == buffer_.size()) refill();
+        std::size_t take = std::min(out.size() - done, buffer_.size() - used_);
+        std::memcpy(out.data() + done, buffer_.data() + used_, take);
+        std::memset(buffer_.data() + used_, 0, take);
+        used_ += take;
+        done += take;
+    }
+}
+
+// One generator per thread, seeded the first time the thread asks for it
+ChaChaRng& thread_rng(){
+    thread_local ChaChaRng rng;
+    return rng;
+}
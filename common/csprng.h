@@ -0,0 +1,45 @@
+#ifndef CSPRNG_H
+#define CSPRNG_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+constexpr std::size_t CHACHA_BLOCK_BYTES = 64;
+constexpr std::size_t CHACHA_BUFFER_BLOCKS = 4; // keystream produced per refill
+constexpr std::size_t CHACHA_KEY_BYTES = 32;
+
+void chacha20_block(const std::array<std::uint32_t, 16>& input, std::uint8_t* out);
+void chacha20_keystream(std::span<const std::uint8_t, CHACHA_KEY_BYTES> key, std::uint64_t stream, std::span<std::uint8_t> out);
+
+/*
+ * ChaCha20 Random Generator
+ *
+ * Cryptographically secure generator seeded once from the operating system (getrandom() on Linux), then run
+ * entirely in user space. Each refill produces CHACHA_BUFFER_BLOCKS blocks of keystream and immediately replaces the
+ * key with the first 32 bytes of it, so a later look at the state cannot recover output already handed out.
+ * Meets the UniformRandomBitGenerator requirements, so it works with the Boost and std distributions.
+ */
+class ChaChaRng {
+public:
+    using result_type = std::uint64_t;
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return ~result_type(0); }
+
+    ChaChaRng();
+
+    result_type operator()();
+    void fill(std::span<std::uint8_t> out);
+
+private:
+    void refill();
+
+    std::array<std::uint8_t, CHACHA_KEY_BYTES> key_;
+    std::array<std::uint8_t, CHACHA_BLOCK_BYTES * CHACHA_BUFFER_BLOCKS> buffer_;
+    std::size_t used_ = CHACHA_BLOCK_BYTES * CHACHA_BUFFER_BLOCKS; // bytes of buffer_ already handed out (or used as the next key)
+};
+
+ChaChaRng& thread_rng();
+
+#endif
@@ -0,0 +1,101 @@
+/*
+ *  File: envelope.cpp
+ * Author: Johnny CW
+ * Date: October 16, 2026
+ * Envelope mode: RSA carries the per-message nonce, AES-128-CBC keyed from it carries the payload
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <boost/multiprecision/cpp_int.hpp>
+#include "envelope.h"
+
+using namespace boost::multiprecision;
+
+
+/*
+ * Envelope Key
+ *
+ * Variables:
+ * bytes: the low 32 bytes of the nonce, least significant first (zero-extended for a modulus under 256 bits)
+ * key, iv: the first and second 16 of them
+ *
+ * Purpose:
+ * The nonce is already random, secret and sent RSA-encrypted with every message, so it doubles as the symmetric key
+ * material and RSA runs once per message instead of once per block.
+ */
+EnvelopeKey make_envelope_key(const cpp_int& nonce){
+    std::vector<std::uint8_t> bytes;
+    export_bits(nonce, std::back_inserter(bytes), 8, false);
+    bytes.resize(AES128_KEY_BYTES + AES_BLOCK_BYTES, 0);
+
+    EnvelopeKey k;
+    k.key = make_aes128_key(bytes.data());
+    std::copy_n(bytes.data() + AES128_KEY_BYTES, AES_BLOCK_BYTES, k.iv.begin());
+    return k;
+}
+
+
+/*
+ * Envelope Encryption and Decryption
+ *
+ * The AES ciphertext goes on the wire as one 128-bit number per block, big-endian, so envelope messages use the same
+ * nonce|c1,c2,... format as the RSA modes. Sizes and return values follow CBC into caller buffers in rsa_cbc.cpp;
+ * decryption fails on bad padding or a block wider than 128 bits.
+ */
+std::size_t envelope_cipher_blocks(std::size_t plaintext_bytes){
+    return aes_cbc_cipher_bytes(plaintext_bytes) / AES_BLOCK_BYTES;
+}
+
+std::size_t envelope_plaintext_bytes(std::size_t cipher_blocks){
+    return cipher_blocks * AES_BLOCK_BYTES;
+}
+
+std::size_t envelope_encrypt(std::string_view plaintext, const cpp_int& nonce, std::span<cpp_int> out){
+    std::size_t blocks = envelope_cipher_blocks(plaintext.size());
+    if (out.size() < blocks) return 0;
+    EnvelopeKey k = make_envelope_key(nonce);
+    std::vector<std::uint8_t> cipher(blocks * AES_BLOCK_BYTES);
+    aes_cbc_encrypt(k.key, k.iv, plaintext, cipher);
+    for (std::size_t b = 0; b < blocks; ++b){
+        import_bits(out[b], cipher.begin() + b * AES_BLOCK_BYTES, cipher.begin() + (b + 1) * AES_BLOCK_BYTES, 8, true);
+    }
+    return blocks;
+}
+
+// The AES ciphertext bytes of envelope blocks; false if a block is wider than 128 bits or out is too small
+bool envelope_cipher_bytes(std::span<const cpp_int> cipher, std::span<std::uint8_t> out){
+    if (out.size() < cipher.size() * AES_BLOCK_BYTES) return false;
+    std::fill_n(out.begin(), cipher.size() * AES_BLOCK_BYTES, std::uint8_t(0));
+    for (std::size_t b = 0; b < cipher.size(); ++b){
+        if (cipher[b] < 0 || msb(cipher[b] | 1) >= 8 * AES_BLOCK_BYTES) return false;
+        if (cipher[b] == 0) continue;
+        std::size_t len = (msb(cipher[b]) + 8) / 8;
+        export_bits(cipher[b], out.begin() + (b + 1) * AES_BLOCK_BYTES - len, 8, true);
+    }
+    return true;
+}
+
+bool envelope_decrypt(std::span<const cpp_int> cipher, const cpp_int& nonce, std::span<char> out, std::size_t& length){
+    length = 0;
+    if (out.size() < envelope_plaintext_bytes(cipher.size())) return false;
+    std::vector<std::uint8_t> bytes(cipher.size() * AES_BLOCK_BYTES);
+    if (!envelope_cipher_bytes(cipher, bytes)) return false;
+    EnvelopeKey k = make_envelope_key(nonce);
+    return aes_cbc_decrypt(k.key, k.iv, bytes, out, length);
+}
+
+std::vector<cpp_int> envelope_encrypt(const std::string& plaintext, const cpp_int& nonce){
+    std::vector<cpp_int> cipher(envelope_cipher_blocks(plaintext.size()));
+    envelope_encrypt(plaintext, nonce, cipher);
+    return cipher;
+}
+
+std::string envelope_decrypt(const std::vector<cpp_int>& cipher, const cpp_int& nonce){
+    std::string plaintext(envelope_plaintext_bytes(cipher.size()), '\0');
+    std::size_t length;
+    if (!envelope_decrypt(cipher, nonce, plaintext, length)) return std::string();
+    plaintext.resize(length);
+    return plaintext;
+}
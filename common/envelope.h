@@ -0,0 +1,30 @@
+#ifndef ENVELOPE_H
+#define ENVELOPE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <boost/multiprecision/cpp_int.hpp>
+#include "aes.h"
+
+using namespace boost::multiprecision;
+
+// AES key and IV of one envelope-mode message, both taken from the message nonce
+struct EnvelopeKey {
+    Aes128Key key;
+    AesBlock iv;
+};
+
+EnvelopeKey make_envelope_key(const cpp_int& nonce);
+std::size_t envelope_cipher_blocks(std::size_t plaintext_bytes);
+std::size_t envelope_plaintext_bytes(std::size_t cipher_blocks);
+std::size_t envelope_encrypt(std::string_view plaintext, const cpp_int& nonce, std::span<cpp_int> out);
+bool envelope_cipher_bytes(std::span<const cpp_int> cipher, std::span<std::uint8_t> out);
+bool envelope_decrypt(std::span<const cpp_int> cipher, const cpp_int& nonce, std::span<char> out, std::size_t& length);
+std::vector<cpp_int> envelope_encrypt(const std::string& plaintext, const cpp_int& nonce);
+std::string envelope_decrypt(const std::vector<cpp_int>& cipher, const cpp_int& nonce);
+
+#endif
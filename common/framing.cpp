@@ -0,0 +1,91 @@
+/*
+ *  File: framing.cpp
+ * Author: Johnny CW
+ * Date: October 16, 2026
+ * Reassembles whole messages from a TCP byte stream, whatever the recv() boundaries
+ */
+
+#include <algorithm>
+#include <cstring>
+#include "framing.h"
+
+
+void FrameReader::feed(std::string_view bytes){
+    buffer_.append(bytes);
+}
+
+// Drops consumed bytes from the front once they are at least half the buffer, so each byte is moved at most once
+void FrameReader::consume(std::size_t bytes){
+    start_ += bytes;
+    if (start_ == buffer_.size()){
+        buffer_.clear();
+        start_ = 0;
+    } else if (start_ >= buffer_.size() / 2){
+        buffer_.erase(0, start_);
+        start_ = 0;
+    }
+}
+
+
+/*
+ * Next Frame Event
+ *
+ * Variables:
+ * in_binary_, blocks_left_: inside a binary message, the number of its blocks not handed out yet
+ * chunk: blocks handed out by the next Blocks event, FRAME_CHUNK_BLOCKS or what is left of the message
+ *
+ * Purpose:
+ * The first byte tells the formats apart: a binary message starts with WIRE_MAGIC (a zero byte), a text message
+ * with a digit. A Blocks event waits for a whole chunk, so the decryption behind it gets reasonable batches.
+ */
+FrameEvent FrameReader::next(){
+    std::size_t available = buffered();
+
+    if (in_binary_){
+        if (blocks_left_ == 0){
+            in_binary_ = false;
+            return FrameEvent::End;
+        }
+        std::size_t chunk = std::min<std::size_t>(FRAME_CHUNK_BLOCKS, blocks_left_);
+        if (available < chunk * header_.block_bytes) return FrameEvent::NeedMore;
+        blocks_.resize(chunk);
+        for (std::size_t i = 0; i < chunk; ++i){
+            read_wire_number(blocks_[i], data() + i * header_.block_bytes, header_.block_bytes, words_);
+        }
+        consume(chunk * header_.block_bytes);
+        blocks_left_ -= static_cast<std::uint32_t>(chunk);
+        return FrameEvent::Blocks;
+    }
+
+    if (available == 0) return FrameEvent::NeedMore;
+
+    if (data()[0] == WIRE_MAGIC[0]){
+        if (std::memcmp(data(), WIRE_MAGIC, std::min(available, sizeof(WIRE_MAGIC))) != 0) return FrameEvent::Error;
+        if (available < WIRE_HEADER_BYTES) return FrameEvent::NeedMore;
+        if (!parse_wire_header(std::string_view(reinterpret_cast<const char*>(data()), available), header_)) return FrameEvent::Error;
+        if (available < WIRE_HEADER_BYTES + header_.nonce_bytes) return FrameEvent::NeedMore;
+        read_wire_number(nonce_, data() + WIRE_HEADER_BYTES, header_.nonce_bytes, words_);
+        consume(WIRE_HEADER_BYTES + header_.nonce_bytes);
+        in_binary_ = true;
+        blocks_left_ = header_.block_count;
+        return FrameEvent::Begin;
+    }
+
+    std::string_view view(reinterpret_cast<const char*>(data()), available);
+    std::size_t newline = view.find('\n');
+    if (newline == std::string_view::npos){
+        return available > MAX_TEXT_FRAME_BYTES ? FrameEvent::Error : FrameEvent::NeedMore;
+    }
+    std::size_t length = newline;
+    if (length > 0 && view[length - 1] == '\r') --length;
+    text_.assign(view.substr(0, length));
+    consume(newline + 1);
+    return FrameEvent::Text;
+}
+
+FrameEvent FrameReader::flush(){
+    if (in_binary_ || buffered() == 0 || data()[0] < '0' || data()[0] > '9') return FrameEvent::NeedMore; // original frames are decimal
+    text_.assign(reinterpret_cast<const char*>(data()), buffered());
+    consume(buffered());
+    return FrameEvent::Text;
+}
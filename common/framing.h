@@ -0,0 +1,67 @@
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <boost/multiprecision/cpp_int.hpp>
+#include "protocol.h"
+
+using namespace boost::multiprecision;
+
+constexpr std::size_t FRAME_CHUNK_BLOCKS = 256;            // binary blocks handed out per Blocks event
+constexpr std::size_t MAX_TEXT_FRAME_BYTES = 8 << 20;      // text frames are parsed whole, so they are capped
+
+// What FrameReader::next() found in the bytes received so far
+enum class FrameEvent {
+    NeedMore, // nothing complete yet; feed more bytes
+    Text,     // a whole text frame, in text()
+    Begin,    // a binary message header and its nonce, in header() and nonce()
+    Blocks,   // the next blocks of the current binary message, in blocks()
+    End,      // the current binary message is complete
+    Error,    // the stream cannot be read any further
+};
+
+/*
+ * Frame Reader
+ *
+ * Per-connection reassembly buffer that turns a TCP byte stream into messages, however the bytes were split or
+ * merged by recv(). Binary messages carry their length in the header and are handed out a chunk of blocks at a time,
+ * so a message of any length is read in memory bounded by FRAME_CHUNK_BLOCKS blocks. Text frames end with '\n',
+ * and next() waits for it however the frame was split.
+ * Clients of the original protocol sent one message per send() with no newline. For them alone, the owner may call
+ * flush() once the bytes from a read are used up, to take what is buffered as a whole frame. It does so only for
+ * a frame that starts with a digit, as the original format always does; never call it on a connection that has
+ * used the newer protocol.
+ */
+class FrameReader {
+public:
+    void feed(std::string_view bytes);
+    FrameEvent next();
+    FrameEvent flush();
+
+    std::string_view text() const { return text_; }
+    const WireHeader& header() const { return header_; }
+    const cpp_int& nonce() const { return nonce_; }
+    std::span<const cpp_int> blocks() const { return blocks_; }
+    std::size_t buffered() const { return buffer_.size() - start_; }
+
+private:
+    const std::uint8_t* data() const { return reinterpret_cast<const std::uint8_t*>(buffer_.data()) + start_; }
+    void consume(std::size_t bytes);
+
+    std::string buffer_;
+    std::size_t start_ = 0;           // bytes of buffer_ already consumed
+    bool in_binary_ = false;          // between Begin and End
+    std::uint32_t blocks_left_ = 0;
+    WireHeader header_{};
+    cpp_int nonce_;
+    std::vector<cpp_int> blocks_;
+    std::string text_;
+    std::vector<std::uint64_t> words_;
+};
+
+#endif
@@ -0,0 +1,131 @@
+/*
+ *  File: key_pool.cpp
+ * Author: Johnny CW
+ * Date: October 16, 2026
+ * RSA keys generated ahead of time on background threads
+ */
+
+#include <algorithm>
+#include <utility>
+#include "key_pool.h"
+
+#if defined _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined __linux__
+#include <sys/resource.h>
+#endif
+
+
+// Lowers the calling thread's priority, so key generation only gets the CPU time the server is not using
+static void lower_thread_priority(){
+#if defined _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined __linux__
+    setpriority(PRIO_PROCESS, 0, 19); // on Linux this applies to the calling thread only
+#endif
+}
+
+
+KeyPool::KeyPool(int bits, std::size_t capacity, unsigned threads)
+    : bits_(bits), capacity_(capacity) {
+    workers_.reserve(threads);
+    for (unsigned i = 0; i < threads; ++i){
+        workers_.emplace_back([this](std::stop_token stop){ worker_loop(stop); });
+    }
+}
+
+KeyPool::~KeyPool(){
+    for (std::jthread& worker : workers_) worker.request_stop();
+}
+
+
+/*
+ * Background Generation
+ *
+ * Variables:
+ * in_progress_: keys being generated right now, counted against capacity so the threads never overshoot it
+ * generation_time_: total time the threads spent generating, for the rate metrics
+ *
+ * Purpose:
+ * Each thread waits for room in the pool, generates one key with a single thread of its own, and adds it.
+ */
+void KeyPool::worker_loop(std::stop_token stop){
+    lower_thread_priority();
+    while (true){
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!space_.wait(lock, stop, [this]{ return stock_.size() + in_progress_ < capacity_; })) return;
+            ++in_progress_;
+        }
+
+        RsaPrivateKey key;
+        auto start = std::chrono::steady_clock::now();
+        bool done = generate_rsa_keys(key, bits_, stop);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        --in_progress_;
+        if (!done) return;
+        stock_.push_back(std::move(key));
+        ++generated_;
+        generation_time_ += elapsed;
+        ready_.notify_one();
+    }
+}
+
+
+/*
+ * Returns a ready key if there is one. Otherwise the caller generates one itself (all cores, p and q in parallel)
+ * rather than wait for a low-priority thread that may be starved.
+ */
+RsaPrivateKey KeyPool::take(){
+    RsaPrivateKey key;
+    if (try_take(key)) return key;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++misses_;
+        ++handed_out_;
+    }
+    generate_rsa_keys_parallel(key, bits_, std::max(1u, std::thread::hardware_concurrency()));
+    return key;
+}
+
+bool KeyPool::try_take(RsaPrivateKey& key){
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stock_.empty()) return false;
+        key = std::move(stock_.front());
+        stock_.pop_front();
+        ++handed_out_;
+    }
+    space_.notify_one();
+    return true;
+}
+
+// Waits for a background thread to finish a key rather than generating one here; false if stop is requested first
+bool KeyPool::wait_take(RsaPrivateKey& key, std::stop_token stop){
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!ready_.wait(lock, stop, [this]{ return !stock_.empty(); })) return false;
+        key = std::move(stock_.front());
+        stock_.pop_front();
+        ++handed_out_;
+    }
+    space_.notify_one();
+    return true;
+}
+
+KeyPoolMetrics KeyPool::metrics() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    KeyPoolMetrics m;
+    m.depth = stock_.size();
+    m.capacity = capacity_;
+    m.generated = generated_;
+    m.handed_out = handed_out_;
+    m.misses = misses_;
+    double seconds = std::chrono::duration<double>(generation_time_).count();
+    m.mean_generation_seconds = generated_ ? seconds / static_cast<double>(generated_) : 0.0;
+    m.keys_per_second = m.mean_generation_seconds > 0 ? static_cast<double>(workers_.size()) / m.mean_generation_seconds : 0.0;
+    return m;
+}
@@ -0,0 +1,64 @@
+#ifndef KEY_POOL_H
+#define KEY_POOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+#include "rsa_cbc.h"
+
+// Snapshot of a KeyPool's counters
+struct KeyPoolMetrics {
+    std::size_t depth;              // keys ready to hand out
+    std::size_t capacity;
+    std::uint64_t generated;        // by the background threads
+    std::uint64_t handed_out;
+    std::uint64_t misses;           // take() calls that found the pool empty and generated on the caller's thread
+    double mean_generation_seconds; // per key, on one background thread
+    double keys_per_second;         // estimate, threads / mean_generation_seconds: the rate with every thread busy, not a measured one
+};
+
+/*
+ * Background Key Pool
+ *
+ * Keeps up to capacity RSA keys of one size ready, generated on low-priority background threads, so a key is
+ * available the moment one is asked for. The threads sleep while the pool is full and stop, abandoning any key in
+ * progress, when the pool is destroyed.
+ */
+class KeyPool {
+public:
+    KeyPool(int bits, std::size_t capacity, unsigned threads = 1);
+    ~KeyPool();
+
+    KeyPool(const KeyPool&) = delete;
+    KeyPool& operator=(const KeyPool&) = delete;
+
+    int bits() const { return bits_; }
+    RsaPrivateKey take();
+    bool try_take(RsaPrivateKey& key);
+    bool wait_take(RsaPrivateKey& key, std::stop_token stop);
+    KeyPoolMetrics metrics() const;
+
+private:
+    void worker_loop(std::stop_token stop);
+
+    int bits_;
+    std::size_t capacity_;
+    mutable std::mutex mutex_;
+    std::condition_variable_any space_;
+    std::condition_variable_any ready_;
+    std::deque<RsaPrivateKey> stock_;
+    std::size_t in_progress_ = 0;
+    std::uint64_t generated_ = 0;
+    std::uint64_t handed_out_ = 0;
+    std::uint64_t misses_ = 0;
+    std::chrono::steady_clock::duration generation_time_{};
+    std::vector<std::jthread> workers_; // last, so the threads stop before the rest is destroyed
+};
+
+#endif
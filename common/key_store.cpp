@@ -0,0 +1,269 @@
+/*
+ *  File: key_store.cpp
+ * Author: Johnny CW
+ * Date: October 16, 2026
+ * Binary RSA key file, so a restarted server keeps its key instead of searching for new primes
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <vector>
+#include "key_store.h"
+#include "key_pool.h"
+
+#if !defined _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace boost::multiprecision;
+
+
+static void put_u32(std::uint8_t* p, std::uint32_t v){
+    p[0] = static_cast<std::uint8_t>(v >> 24);
+    p[1] = static_cast<std::uint8_t>(v >> 16);
+    p[2] = static_cast<std::uint8_t>(v >> 8);
+    p[3] = static_cast<std::uint8_t>(v);
+}
+
+static std::uint32_t get_u32(const std::uint8_t* p){
+    return (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16) | (std::uint32_t(p[2]) << 8) | p[3];
+}
+
+std::size_t key_file_bytes(std::size_t limbs){
+    return KEY_FILE_HEADER_BYTES + KEY_FILE_FIELDS * limbs * 8;
+}
+
+
+/*
+ * Read-only view of a whole file: mmap where there is one, otherwise the file read into memory.
+ * Empty if the file cannot be opened.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path){
+#if defined _WIN32
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return;
+        copy_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        data_ = reinterpret_cast<const std::uint8_t*>(copy_.data());
+        size_ = copy_.size();
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0){
+            void* p = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED){
+                data_ = static_cast<const std::uint8_t*>(p);
+                size_ = static_cast<std::size_t>(st.st_size);
+            }
+        }
+        ::close(fd); // the mapping stays valid without the descriptor
+#endif
+    }
+
+    ~MappedFile(){
+#if !defined _WIN32
+        if (data_) ::munmap(const_cast<std::uint8_t*>(data_), size_);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const std::uint8_t* data() const { return data_; }
+    std::size_t size() const { return size_; }
+
+private:
+    const std::uint8_t* data_ = nullptr;
+    std::size_t size_ = 0;
+#if defined _WIN32
+    std::vector<char> copy_;
+#endif
+};
+
+
+/*
+ * Save RSA Key
+ *
+ * Variables:
+ * limbs: 64-bit limbs per field, enough for n; every other field is smaller than n
+ * tmp: the file is written next to its destination and renamed over it, so a crash never leaves half a key behind
+ *
+ * Purpose:
+ * Writes the private key with its CRT parameters. On POSIX the file is created readable by its owner only.
+ */
+bool save_rsa_key(const std::string& path, const RsaPrivateKey& key){
+    std::size_t limbs = (msb(key.n) + 64) / 64;
+    std::vector<std::uint8_t> file(key_file_bytes(limbs), 0);
+    std::memcpy(file.data(), KEY_FILE_MAGIC, sizeof(KEY_FILE_MAGIC));
+    put_u32(file.data() + 4, KEY_FILE_VERSION);
+    put_u32(file.data() + 8, static_cast<std::uint32_t>(msb(key.n) + 1));
+    put_u32(file.data() + 12, static_cast<std::uint32_t>(limbs));
+
+    const cpp_int* fields[KEY_FILE_FIELDS] = {&key.n, &key.e, &key.d, &key.p, &key.q, &key.dp, &key.dq, &key.qinv};
+    std::size_t field_bytes = limbs * 8;
+    for (std::size_t f = 0; f < KEY_FILE_FIELDS; ++f){
+        if (*fields[f] < 0 || msb(*fields[f]) >= limbs * 64) return false;
+        std::vector<std::uint8_t> bytes;
+        export_bits(*fields[f], std::back_inserter(bytes), 8, true);
+        std::uint8_t* slot = file.data() + KEY_FILE_HEADER_BYTES + f * field_bytes;
+        std::copy(bytes.begin(), bytes.end(), slot + field_bytes - bytes.size());
+    }
+
+    std::string tmp = path + ".tmp";
+#if defined _WIN32
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out.write(reinterpret_cast<const char*>(file.data()), static_cast<std::streamsize>(file.size()))) return false;
+    }
+#else
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) return false;
+    std::size_t written = 0;
+    while (written < file.size()){
+        ssize_t n = ::write(fd, file.data() + written, file.size() - written);
+        if (n <= 0){
+            ::close(fd);
+            std::remove(tmp.c_str());
+            return false;
+        }
+        written += static_cast<std::size_t>(n);
+    }
+    bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    if (!synced){
+        std::remove(tmp.c_str());
+        return false;
+    }
+#endif
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec){
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+/*
+ * Load RSA Key
+ *
+ * Purpose:
+ * Maps the key file and reads the fields straight out of the mapping. The key is checked before it is used:
+ * n = p * q, and d, dp, dq and qinv must be the inverses they claim to be. That costs a few multiplications,
+ * against the prime search it replaces. p and q must also be balanced, within a bit of each other as the key
+ * generator makes them: a lopsided key is weaker and is not what the fixed-width engines are sized for. Returns
+ * false, leaving key untouched, if the file is missing or invalid.
+ */
+bool load_rsa_key(const std::string& path, RsaPrivateKey& key){
+    MappedFile file(path);
+    const std::uint8_t* data = file.data();
+    if (!data || file.size() < KEY_FILE_HEADER_BYTES) return false;
+    if (std::memcmp(data, KEY_FILE_MAGIC, sizeof(KEY_FILE_MAGIC)) != 0) return false;
+    if (get_u32(data + 4) != KEY_FILE_VERSION) return false;
+    std::uint32_t bits = get_u32(data + 8);
+    std::size_t limbs = get_u32(data + 12);
+    if (limbs == 0 || limbs > 1024 || file.size() != key_file_bytes(limbs)) return false;
+
+    std::array<cpp_int, KEY_FILE_FIELDS> fields;
+    std::size_t field_bytes = limbs * 8;
+    for (std::size_t f = 0; f < KEY_FILE_FIELDS; ++f){
+        const std::uint8_t* slot = data + KEY_FILE_HEADER_BYTES + f * field_bytes;
+        import_bits(fields[f], slot, slot + field_bytes, 8, true);
+    }
+
+    RsaPrivateKey loaded;
+    loaded.n = fields[0];
+    loaded.e = fields[1];
+    loaded.d = fields[2];
+    loaded.p = fields[3];
+    loaded.q = fields[4];
+    loaded.dp = fields[5];
+    loaded.dq = fields[6];
+    loaded.qinv = fields[7];
+
+    if (loaded.p < 3 || loaded.q < 3 || !bit_test(loaded.p, 0) || !bit_test(loaded.q, 0)) return false;
+    if (loaded.n != loaded.p * loaded.q || msb(loaded.n) + 1 != bits) return false;
+    std::size_t p_bits = msb(loaded.p) + 1, q_bits = msb(loaded.q) + 1;
+    if (std::max(p_bits, q_bits) - std::min(p_bits, q_bits) > 1) return false;
+    cpp_int p1 = loaded.p - 1, q1 = loaded.q - 1;
+    if (loaded.e * loaded.d % (p1 * q1) != 1) return false;
+    if (loaded.dp != loaded.d % p1 || loaded.dq != loaded.d % q1) return false;
+    if (loaded.qinv >= loaded.p || loaded.q * loaded.qinv % loaded.p != 1) return false;
+
+    prepare_rsa_private_key(loaded);
+    key = std::move(loaded);
+    return true;
+}
+
+
+// True if key has the size generate_rsa_keys gives for bits (the top bit of n may be clear)
+static bool has_key_size(const RsaPrivateKey& key, int bits){
+    std::size_t n_bits = msb(key.n) + 1;
+    return n_bits >= static_cast<std::size_t>(bits - 1) && n_bits <= static_cast<std::size_t>(bits);
+}
+
+// Where pregenerate_next_rsa_key keeps the key the next rotation switches to
+std::string next_key_path(const std::string& path){
+    return path + ".next";
+}
+
+
+/*
+ * Load or Generate RSA Key
+ *
+ * Variables:
+ * rotate: replace the key even if the file holds a valid one
+ * next: the key pregenerate_next_rsa_key prepared, used before generating one here
+ *
+ * Purpose:
+ * Server start-up: reuse the key in the file when it is valid and of the requested size. Otherwise take the
+ * pre-generated next key if there is a valid one, which costs a rename instead of a prime search, and only then
+ * generate one (p and q searched in parallel) and write it for the next start.
+ */
+KeySource load_or_generate_rsa_key(const std::string& path, int bits, bool rotate, RsaPrivateKey& key){
+    if (!rotate && load_rsa_key(path, key) && has_key_size(key, bits)) return KeySource::Loaded;
+
+    std::string next = next_key_path(path);
+    if (load_rsa_key(next, key) && has_key_size(key, bits)){
+        std::error_code error;
+        std::filesystem::rename(next, path, error);
+        if (!error) return KeySource::Pregenerated;
+        if (save_rsa_key(path, key)){
+            std::remove(next.c_str());
+            return KeySource::Pregenerated;
+        }
+    }
+    generate_rsa_keys_parallel(key, bits, std::max(1u, std::thread::hardware_concurrency()));
+    return save_rsa_key(path, key) ? KeySource::Generated : KeySource::GeneratedUnsaved;
+}
+
+
+/*
+ * Next Key Pre-generation
+ *
+ * Unless next_key_path(path) already holds a valid key of this size, generates one on a KeyPool's low-priority
+ * thread while the server runs and writes it there, so the next --rotate-key (or a start with the key file lost)
+ * does not wait for a prime search. Returns the thread waiting for the key, or an empty one if there is nothing to
+ * do; destroying it abandons a key still in progress.
+ */
+std::jthread pregenerate_next_rsa_key(const std::string& path, int bits){
+    RsaPrivateKey existing;
+    if (load_rsa_key(next_key_path(path), existing) && has_key_size(existing, bits)) return std::jthread();
+    return std::jthread([path, bits](std::stop_token stop){
+        KeyPool pool(bits, 1);
+        RsaPrivateKey next;
+        if (pool.wait_take(next, stop)) save_rsa_key(next_key_path(path), next);
+    });
+}
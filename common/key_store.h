@@ -0,0 +1,38 @@
+#ifndef KEY_STORE_H
+#define KEY_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include "rsa_cbc.h"
+
+/*
+ * Key file layout, every integer big-endian:
+ *   0  magic "RSAK"
+ *   4  u32 format version
+ *   8  u32 modulus bits
+ *  12  u32 limbs, the number of 64-bit limbs in each field
+ *  16  n, e, d, p, q, dp, dq, qinv, each limbs * 8 bytes, most significant limb first
+ */
+constexpr char KEY_FILE_MAGIC[4] = {'R', 'S', 'A', 'K'};
+constexpr std::uint32_t KEY_FILE_VERSION = 1;
+constexpr std::size_t KEY_FILE_HEADER_BYTES = 16;
+constexpr std::size_t KEY_FILE_FIELDS = 8;
+
+// Where load_or_generate_rsa_key got its key from
+enum class KeySource {
+    Loaded,
+    Pregenerated,     // the next key, generated in the background by an earlier run, now moved to the key file
+    Generated,        // and written to the key file
+    GeneratedUnsaved, // the key file could not be written
+};
+
+std::size_t key_file_bytes(std::size_t limbs);
+bool save_rsa_key(const std::string& path, const RsaPrivateKey& key);
+bool load_rsa_key(const std::string& path, RsaPrivateKey& key);
+KeySource load_or_generate_rsa_key(const std::string& path, int bits, bool rotate, RsaPrivateKey& key);
+std::string next_key_path(const std::string& path);
+std::jthread pregenerate_next_rsa_key(const std::string& path, int bits);
+
+#endif
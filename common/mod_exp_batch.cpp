@@ -0,0 +1,290 @@
+/*
+ *  File: mod_exp_batch.cpp
+ * Author: Johnny CW
+ * Date: October 16, 2026
+ * Batched modular exponentiation: many bases, one exponent, one modulus, run across vector lanes
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <new>
+#include <span>
+#include <vector>
+#include <boost/multiprecision/cpp_int.hpp>
+#include "mod_exp_batch.h"
+#include "rsa_engine.h"
+
+#if (defined __GNUC__ || defined __clang__) && defined __x86_64__
+#define HAVE_IFMA_KERNEL 1
+#include <immintrin.h>
+#define IFMA_TARGET __attribute__((target("avx512f,avx512ifma")))
+#else
+#define HAVE_IFMA_KERNEL 0
+#endif
+
+using namespace boost::multiprecision;
+
+constexpr std::size_t SIMD_MAX_LIMBS = 80; // enough radix 2^52 limbs for a 4096-bit modulus
+constexpr std::uint64_t MASK52 = (std::uint64_t(1) << 52) - 1;
+
+
+/*
+ * Runtime CPU Dispatch
+ *
+ * The vector kernel needs AVX-512 IFMA (52-bit multiply-accumulate). It is compiled for that target regardless of
+ * the build flags and only called when the CPU reports support; everything else falls back to the scalar kernels.
+ */
+bool simd_batch_available(){
+#if HAVE_IFMA_KERNEL
+    static const bool available = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512ifma");
+    return available;
+#else
+    return false;
+#endif
+}
+
+
+/*
+ * Vector Kernel Modulus
+ *
+ * Variables:
+ * limbs: K, the number of 52-bit limbs, chosen so that R = 2^(52K) > 2n
+ * n: the modulus in radix 2^52
+ * n0: -n^-1 mod 2^52
+ * r2: R^2 mod n in radix 2^52, used to move values into Montgomery form
+ */
+SimdModulus make_simd_modulus(const cpp_int& mod){
+    SimdModulus m;
+    if (mod <= 1 || mod % 2 == 0) return m;
+    m.limbs = (msb(mod) + 2 + 51) / 52;
+    if (m.limbs > SIMD_MAX_LIMBS) return m;
+
+    cpp_int r2 = (cpp_int(1) << (104 * m.limbs)) % mod;
+    m.n.resize(m.limbs);
+    m.r2.resize(m.limbs);
+    for (std::size_t k = 0; k < m.limbs; ++k){
+        m.n[k] = cpp_int((mod >> (52 * k)) & MASK52).convert_to<std::uint64_t>();
+        m.r2[k] = cpp_int((r2 >> (52 * k)) & MASK52).convert_to<std::uint64_t>();
+    }
+    std::uint64_t inv = 1;
+    for (int i = 0; i < 6; ++i) inv *= 2 - m.n[0] * inv;
+    m.n0 = (0 - inv) & MASK52;
+    m.usable = true;
+    return m;
+}
+
+
+#if HAVE_IFMA_KERNEL
+
+/*
+ * Vector Montgomery Multiplication
+ *
+ * Variables:
+ * a, b, r: K vectors each; vector j holds limb j of all 8 lanes, so every instruction works on 8 numbers at once
+ * t: accumulator, limbs are allowed to grow past 52 bits inside the loop and are only normalized at the end
+ * q: per-lane reduction multiplier, low 52 bits of t[0] * n0
+ *
+ * Purpose:
+ * The same word-serial Montgomery product as MontgomeryField::mul, but with the 64x64 scalar multiply replaced by
+ * the 52x52 vector multiply-add (vpmadd52luq / vpmadd52huq). With R > 2n and inputs below n the result is below 2n,
+ * and a final masked subtraction brings each lane below n.
+ */
+IFMA_TARGET static void ifma_mont_mul(const __m512i* a, const __m512i* b, __m512i* r, const __m512i* n,
+                                      __m512i n0, std::size_t K){
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i mask = _mm512_set1_epi64(static_cast<long long>(MASK52));
+    __m512i t[SIMD_MAX_LIMBS + 1];
+    for (std::size_t j = 0; j <= K; ++j) t[j] = zero;
+
+    for (std::size_t i = 0; i < K; ++i){
+        __m512i bi = b[i];
+        for (std::size_t j = 0; j < K; ++j){
+            t[j] = _mm512_madd52lo_epu64(t[j], a[j], bi);
+            t[j + 1] = _mm512_madd52hi_epu64(t[j + 1], a[j], bi);
+        }
+        __m512i q = _mm512_madd52lo_epu64(zero, t[0], n0);
+        for (std::size_t j = 0; j < K; ++j){
+            t[j] = _mm512_madd52lo_epu64(t[j], n[j], q);
+            t[j + 1] = _mm512_madd52hi_epu64(t[j + 1], n[j], q);
+        }
+        // The low 52 bits of t[0] are now zero: carry the rest up and shift down one limb
+        t[1] = _mm512_add_epi64(t[1], _mm512_maskz_srli_epi64(0xff, t[0], 52));
+        for (std::size_t j = 0; j < K; ++j) t[j] = t[j + 1];
+        t[K] = zero;
+    }
+
+    for (std::size_t j = 0; j + 1 < K; ++j){
+        t[j + 1] = _mm512_add_epi64(t[j + 1], _mm512_maskz_srli_epi64(0xff, t[j], 52));
+        t[j] = _mm512_and_si512(t[j], mask);
+    }
+
+    __m512i d[SIMD_MAX_LIMBS];
+    __m512i borrow = zero;
+    for (std::size_t j = 0; j < K; ++j){
+        d[j] = _mm512_sub_epi64(_mm512_sub_epi64(t[j], n[j]), borrow);
+        borrow = _mm512_maskz_srli_epi64(0xff, d[j], 63);
+        d[j] = _mm512_and_si512(d[j], mask);
+    }
+    __mmask8 ge = _mm512_cmpeq_epi64_mask(borrow, zero); // lanes where t >= n take t - n
+    for (std::size_t j = 0; j < K; ++j) r[j] = _mm512_mask_blend_epi64(ge, t[j], d[j]);
+}
+
+
+/*
+ * Vector Windowed Exponentiation
+ *
+ * Runs the recoded exponent on up to 8 lanes; unused lanes compute 0^exp and are discarded.
+ * Bases and results are little-endian 64-bit limbs, "words" per lane, and each base must be below the modulus.
+ */
+IFMA_TARGET static void ifma_pow_lanes(const SimdModulus& mod, const std::uint64_t* bases, std::size_t words,
+                                       std::uint64_t* out, std::size_t count, const WindowedExponent& exp){
+    const std::size_t K = mod.limbs;
+    __m512i n[SIMD_MAX_LIMBS], r2[SIMD_MAX_LIMBS], unit[SIMD_MAX_LIMBS], base[SIMD_MAX_LIMBS];
+    for (std::size_t j = 0; j < K; ++j){
+        n[j] = _mm512_set1_epi64(static_cast<long long>(mod.n[j]));
+        r2[j] = _mm512_set1_epi64(static_cast<long long>(mod.r2[j]));
+        unit[j] = _mm512_set1_epi64(j == 0 ? 1 : 0);
+    }
+    const __m512i n0 = _mm512_set1_epi64(static_cast<long long>(mod.n0));
+
+    // Transpose into limb-major order while converting radix 2^64 to radix 2^52
+    alignas(64) std::uint64_t lane_limbs[BATCH_LANES];
+    for (std::size_t j = 0; j < K; ++j){
+        std::size_t bit = 52 * j, word = bit / 64, shift = bit % 64;
+        for (std::size_t l = 0; l < BATCH_LANES; ++l){
+            std::uint64_t v = 0;
+            if (l < count && word < words){
+                const std::uint64_t* src = bases + l * words;
+                v = src[word] >> shift;
+                if (shift > 12 && word + 1 < words) v |= src[word + 1] << (64 - shift);
+            }
+            lane_limbs[l] = v & MASK52;
+        }
+        base[j] = _mm512_load_si512(lane_limbs);
+    }
+
+    __m512i x[SIMD_MAX_LIMBS];
+    if (exp.steps.empty()){
+        ifma_mont_mul(unit, r2, x, n, n0, K); // R mod n, i.e. 1 in Montgomery form
+    } else {
+        std::size_t entries = std::size_t(1) << (exp.window - 1);
+        auto* table = static_cast<__m512i*>(::operator new(entries * K * sizeof(__m512i), std::align_val_t(64)));
+        __m512i base_sq[SIMD_MAX_LIMBS];
+        ifma_mont_mul(base, r2, table, n, n0, K);
+        ifma_mont_mul(table, table, base_sq, n, n0, K);
+        for (std::size_t k = 1; k < entries; ++k){
+            ifma_mont_mul(&table[(k - 1) * K], base_sq, &table[k * K], n, n0, K);
+        }
+
+        std::copy_n(&table[(exp.steps[0].digit >> 1) * K], K, x);
+        for (std::size_t k = 1; k < exp.steps.size(); ++k){
+            for (std::uint32_t sq = 0; sq < exp.steps[k].squarings; ++sq) ifma_mont_mul(x, x, x, n, n0, K);
+            if (exp.steps[k].digit != 0) ifma_mont_mul(x, &table[(exp.steps[k].digit >> 1) * K], x, n, n0, K);
+        }
+        ::operator delete(table, std::align_val_t(64));
+    }
+    ifma_mont_mul(x, unit, x, n, n0, K);
+
+    for (std::size_t l = 0; l < count; ++l) std::fill_n(out + l * words, words, 0);
+    for (std::size_t j = 0; j < K; ++j){
+        _mm512_store_si512(lane_limbs, x[j]);
+        std::size_t bit = 52 * j, word = bit / 64, shift = bit % 64;
+        for (std::size_t l = 0; l < count; ++l){
+            std::uint64_t* dst = out + l * words;
+            if (word < words) dst[word] |= lane_limbs[l] << shift;
+            if (shift > 12 && word + 1 < words) dst[word + 1] |= lane_limbs[l] >> (64 - shift);
+        }
+    }
+}
+
+#endif
+
+
+/*
+ * Entry point for the vector kernel. Callers check simd_batch_available() and mod.usable first.
+ */
+void simd_pow_lanes(const SimdModulus& mod, const std::uint64_t* bases, std::size_t words, std::uint64_t* out,
+                    std::size_t count, const WindowedExponent& exp){
+#if HAVE_IFMA_KERNEL
+    ifma_pow_lanes(mod, bases, words, out, count, exp);
+#else
+    (void)mod; (void)bases; (void)words; (void)out; (void)count; (void)exp;
+#endif
+}
+
+
+/*
+ * Scalar fallback: the fixed-width Montgomery field with its lanes interleaved, for CPUs without the vector kernel.
+ */
+template <std::size_t N>
+static void batch_fixed(std::span<const cpp_int> bases, const WindowedExponent& exp, const cpp_int& mod,
+                        std::span<cpp_int> out){
+    MontgomeryField<N> field(mod);
+    for (std::size_t i = 0; i < bases.size(); i += BATCH_LANES){
+        std::size_t count = std::min(BATCH_LANES, bases.size() - i);
+        Limbs<N> in[BATCH_LANES], res[BATCH_LANES];
+        for (std::size_t l = 0; l < count; ++l) in[l] = field.to_mont(to_limbs<N>(bases[i + l] % mod));
+        field.template pow_lanes<BATCH_LANES>(in, res, count, exp);
+        for (std::size_t l = 0; l < count; ++l) out[i + l] = from_limbs(field.from_mont(res[l]));
+    }
+}
+
+
+/*
+ * Batched Modular Exponentiation
+ *
+ * Variables:
+ * bases: the values to raise, any size (they are reduced modulo mod first)
+ * exp: the shared exponent, recoded once for the whole batch
+ * mod: the shared modulus
+ * out: receives bases[i]^exp mod mod, must be at least as long as bases
+ *
+ * Purpose:
+ * Independent exponentiations with the same exponent and modulus, like the blocks of one CBC message, follow the
+ * exact same sequence of squarings and multiplies, so they can run in lockstep across vector lanes.
+ * Uses the AVX-512 IFMA kernel when the CPU has it, otherwise the interleaved fixed-width kernel, and plain
+ * mod_exp for even moduli or sizes beyond 4096 bits. There is no AVX2 kernel: AVX2 only multiplies 32x32 bits,
+ * which does not beat the 64-bit scalar kernel at these sizes.
+ * The WindowedExponent overload is for exponents recoded once per key (like a private key's dp and dq); its
+ * modulus must be odd and above 1.
+ */
+void mod_exp_batch(std::span<const cpp_int> bases, const cpp_int& exp, const cpp_int& mod, std::span<cpp_int> out){
+    if (mod <= 1 || mod % 2 == 0 || exp < 0){
+        for (std::size_t i = 0; i < bases.size(); ++i) out[i] = mod_exp(bases[i], exp, mod);
+        return;
+    }
+    mod_exp_batch(bases, recode_exponent(exp), mod, out);
+}
+
+void mod_exp_batch(std::span<const cpp_int> bases, const WindowedExponent& rec, const cpp_int& mod, std::span<cpp_int> out){
+    if (simd_batch_available()){
+        SimdModulus simd = make_simd_modulus(mod);
+        if (simd.usable){
+            std::size_t words = msb(mod) / 64 + 1;
+            std::vector<std::uint64_t> in(BATCH_LANES * words), res(BATCH_LANES * words);
+            for (std::size_t i = 0; i < bases.size(); i += BATCH_LANES){
+                std::size_t count = std::min(BATCH_LANES, bases.size() - i);
+                std::fill(in.begin(), in.end(), 0);
+                for (std::size_t l = 0; l < count; ++l){
+                    export_bits(cpp_int(bases[i + l] % mod), in.begin() + l * words, 64, false);
+                }
+                simd_pow_lanes(simd, in.data(), words, res.data(), count, rec);
+                for (std::size_t l = 0; l < count; ++l){
+                    import_bits(out[i + l], res.begin() + l * words, res.begin() + (l + 1) * words, 64, false);
+                }
+            }
+            return;
+        }
+    }
+
+    std::size_t bits = msb(mod) + 1;
+    if (bits <= 256) batch_fixed<4>(bases, rec, mod, out);
+    else if (bits <= 512) batch_fixed<8>(bases, rec, mod, out);
+    else if (bits <= 1024) batch_fixed<16>(bases, rec, mod, out);
+    else if (bits <= 2048) batch_fixed<32>(bases, rec, mod, out);
+    else if (bits <= 4096) batch_fixed<64>(bases, rec, mod, out);
+    else {
+        MontgomeryContext ctx = make_montgomery_context(mod);
+        for (std::size_t i = 0; i < bases.size(); ++i) out[i] = mod_exp(bases[i], rec, ctx);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef MOD_EXP_BATCH_H
+#define MOD_EXP_BATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <boost/multiprecision/cpp_int.hpp>
+#include "rsa_cbc.h"
+
+using namespace boost::multiprecision;
+
+// Number of exponentiations a batch kernel runs side by side (one per 64-bit lane of a 512-bit vector)
+constexpr std::size_t BATCH_LANES = 8;
+
+// Per-modulus constants for the vector kernel, in radix 2^52 limbs
+struct SimdModulus {
+    std::size_t limbs = 0;
+    std::vector<std::uint64_t> n;
+    std::vector<std::uint64_t> r2;
+    std::uint64_t n0 = 0;
+    bool usable = false;
+};
+
+bool simd_batch_available();
+SimdModulus make_simd_modulus(const cpp_int& mod);
+void simd_pow_lanes(const SimdModulus& mod, const std::uint64_t* bases, std::size_t words, std::uint64_t* out,
+                    std::size_t count, const WindowedExponent& exp);
+void mod_exp_batch(std::span<const cpp_int> bases, const cpp_int& exp, const cpp_int& mod, std::span<cpp_int> out);
+void mod_exp_batch(std::span<const cpp_int> bases, const WindowedExponent& exp, const cpp_int& mod, std::span<cpp_int> out);
+
+#endif
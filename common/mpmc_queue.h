@@ -0,0 +1,89 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+/*
+ * Bounded Lock-Free MPMC Queue
+ *
+ * Ring of slots, each with a sequence number that says whether it holds a value for the current lap (Vyukov's
+ * bounded queue). Producers and consumers claim a position with one compare-and-swap on their own counter and then
+ * work on their slot alone, so any number of threads push and pop without a lock and never wait for one another
+ * unless the queue is full or empty. try_pop() can also fail while the producer of the oldest value is still
+ * writing it; callers that know a value is coming retry.
+ */
+template <typename T>
+class MpmcQueue {
+public:
+    // capacity is rounded up to a power of two
+    explicit MpmcQueue(std::size_t capacity)
+        : mask_(std::bit_ceil(capacity < 2 ? std::size_t(2) : capacity) - 1), slots_(new Slot[mask_ + 1]) {
+        for (std::size_t i = 0; i <= mask_; ++i) slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    std::size_t capacity() const { return mask_ + 1; }
+
+    bool try_push(T&& value){
+        std::size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;){
+            Slot& slot = slots_[pos & mask_];
+            std::size_t seq = slot.sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t lap = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+            if (lap == 0){
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                    slot.value = std::move(value);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (lap < 0){
+                return false; // full
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T& value){
+        std::size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;){
+            Slot& slot = slots_[pos & mask_];
+            std::size_t seq = slot.sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t lap = std::ptrdiff_t(seq) - std::ptrdiff_t(pos + 1);
+            if (lap == 0){
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                    value = std::move(slot.value);
+                    slot.value = T();
+                    slot.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (lap < 0){
+                return false; // empty, or the oldest value is not written yet
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    // Producers and consumers each hammer their own counter, so keep them on separate cache lines
+    static constexpr std::size_t CACHE_LINE = 64;
+
+    const std::size_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+    alignas(CACHE_LINE) std::atomic<std::size_t> tail_{0};
+    alignas(CACHE_LINE) std::atomic<std::size_t> head_{0};
+};
+
+#endif
@@ -0,0 +1,262 @@
+/*
+ *  File: protocol.cpp
+ * Author: Johnny CW
+ * Date: October 16, 2026
+ * Wire formats shared by the client and server: the public key announcement and the encrypted messages,
+ * in the original decimal text form or the binary form
+ */
+
+#include <cstring>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/multiprecision/cpp_int.hpp>
+#include "protocol.h"
+#include "rsa_cbc.h"
+
+using namespace boost::multiprecision;
+
+
+/*
+ * Public Key Announcement
+ *
+ * Format: e|n in decimal, exactly what the original server sent, so clients of the original protocol can still
+ * read it. Returns false if the data cannot be parsed, or if e is not positive or n is below 2^8: such a modulus
+ * has room for no packed byte (packed_block_bytes(n) == 0), and every packed or segmented size would divide by 0.
+ */
+std::string format_public_key(const cpp_int& e, const cpp_int& n){
+    return e.str() + "|" + n.str();
+}
+
+bool parse_public_key(const std::string& data, cpp_int& e, cpp_int& n){
+    size_t delimiter_pos = data.find('|');
+    if (delimiter_pos == std::string::npos) return false;
+    try {
+        e = cpp_int(data.substr(0, delimiter_pos));
+        n = cpp_int(data.substr(delimiter_pos + 1));
+    } catch (const std::exception&) {
+        return false;
+    }
+    return e > 0 && n > 0 && packed_block_bytes(n) != 0;
+}
+
+
+/*
+ * Capability Negotiation
+ *
+ * Purpose:
+ * The modes and formats a server supports are not part of the key announcement, which old clients parse as a
+ * bare e|n. A client asks for them by sending the line CAPABILITY_REQUEST, and the server answers with the line
+ * "CAPS modes|formats": comma-separated lists of the CbcMode values it can decrypt and the WireFormat values it
+ * can read. A client that gets no answer is talking to a server of the original protocol, which only reads
+ * byte-mode text.
+ * parse_capabilities skips values it does not know, so a newer server can add some, and returns false if the
+ * data is not a capability line or lists no mode or format this side knows.
+ */
+template <typename Enum>
+static void append_list(std::string& data, const std::vector<Enum>& values){
+    for (size_t i = 0; i < values.size(); ++i){
+        data += std::to_string(static_cast<int>(values[i]));
+        if (i < values.size() - 1) data += ",";
+    }
+}
+
+static bool parse_list(std::string_view data, int max_value, std::vector<int>& values){
+    values.clear();
+    while (!data.empty()){
+        size_t comma = data.find(',');
+        std::string_view item = data.substr(0, comma);
+        if (item.empty() || item.size() > 3 || item.find_first_not_of("0123456789") != std::string_view::npos) return false;
+        int value = std::stoi(std::string(item));
+        if (value <= max_value) values.push_back(value);
+        data = comma == std::string_view::npos ? std::string_view() : data.substr(comma + 1);
+    }
+    return true;
+}
+
+std::string format_capabilities(const std::vector<CbcMode>& modes, const std::vector<WireFormat>& formats){
+    std::string data = std::string(CAPABILITY_REQUEST) + " ";
+    append_list(data, modes);
+    data += "|";
+    append_list(data, formats);
+    return data;
+}
+
+bool parse_capabilities(std::string_view data, std::vector<CbcMode>& modes, std::vector<WireFormat>& formats){
+    if (data.size() <= CAPABILITY_REQUEST.size() || data.substr(0, CAPABILITY_REQUEST.size()) != CAPABILITY_REQUEST
+        || data[CAPABILITY_REQUEST.size()] != ' ') return false;
+    data.remove_prefix(CAPABILITY_REQUEST.size() + 1);
+    size_t bar = data.find('|');
+    if (bar == std::string_view::npos) return false;
+
+    std::vector<int> mode_values, format_values;
+    if (!parse_list(data.substr(0, bar), static_cast<int>(CbcMode::Envelope), mode_values)) return false;
+    if (!parse_list(data.substr(bar + 1), static_cast<int>(WireFormat::Binary), format_values)) return false;
+    if (mode_values.empty() || format_values.empty()) return false;
+
+    modes.clear();
+    for (int v : mode_values) modes.push_back(static_cast<CbcMode>(v));
+    formats.clear();
+    for (int v : format_values) formats.push_back(static_cast<WireFormat>(v));
+    return true;
+}
+
+
+/*
+ * Encrypted Message
+ *
+ * Format: mode:encrypted_nonce|c1,c2,...,ck with all numbers in decimal. The "mode:" prefix is left out for byte
+ * mode, so byte-mode messages are exactly the original nonce|blocks format.
+ * parse_message also accepts binary messages, so a server reads both formats through it.
+ * Returns false if the data cannot be parsed.
+ */
+std::string format_message(CbcMode mode, const cpp_int& encrypted_nonce, const std::vector<cpp_int>& cipher){
+    std::stringstream send_data;
+    if (mode != CbcMode::Byte) send_data << static_cast<int>(mode) << ":";
+    send_data << encrypted_nonce.str() << "|";
+    for (size_t i = 0; i < cipher.size(); ++i){
+        send_data << cipher[i].str();
+        if (i < cipher.size() - 1) send_data << ",";
+    }
+    return send_data.str();
+}
+
+bool parse_message(const std::string& data, CbcMode& mode, cpp_int& encrypted_nonce, std::vector<cpp_int>& cipher){
+    if (is_binary_message(data)) return parse_binary_message(data, mode, encrypted_nonce, cipher);
+
+    size_t delimiter_pos = data.find('|');
+    if (delimiter_pos == std::string::npos) return false;
+    size_t mode_pos = data.find(':');
+    if (mode_pos > delimiter_pos) mode_pos = std::string::npos;
+
+    cipher.clear();
+    try {
+        mode = mode_pos == std::string::npos ? CbcMode::Byte : static_cast<CbcMode>(std::stoi(data.substr(0, mode_pos)));
+        size_t nonce_start = mode_pos == std::string::npos ? 0 : mode_pos + 1;
+        encrypted_nonce = cpp_int(data.substr(nonce_start, delimiter_pos - nonce_start));
+
+        std::stringstream ss(data.substr(delimiter_pos + 1));
+        std::string block;
+        while (getline(ss, block, ',')){
+            if (!block.empty()) cipher.push_back(cpp_int(block));
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+
+/*
+ * Binary Message
+ *
+ * Variables:
+ * nonce_bytes, block_bytes: field widths; the caller picks them from the key, wire_bytes(n) for RSA values
+ *
+ * Purpose:
+ * The same content as the text format in about half the bytes, and each number is a copy instead of a
+ * decimal conversion. The header carries every size, so binary_message_bytes() gives the length of the whole
+ * message from its first WIRE_HEADER_BYTES.
+ * format_binary_message writes into out (reusing its capacity) and fails, leaving out empty, if a value does not
+ * fit its width. parse_wire_header rejects an unknown version or mode and a nonzero reserved field, and
+ * parse_binary_message also a length that does not match the header.
+ */
+static void put_be(std::uint8_t* p, std::uint64_t v, std::size_t bytes){
+    for (std::size_t i = bytes; i-- > 0; v >>= 8) p[i] = static_cast<std::uint8_t>(v);
+}
+
+static std::uint64_t get_be(const std::uint8_t* p, std::size_t bytes){
+    std::uint64_t v = 0;
+    for (std::size_t i = 0; i < bytes; ++i) v = (v << 8) | p[i];
+    return v;
+}
+
+// Writes x big-endian into exactly width bytes, false if it needs more. Goes through 64-bit words like read_wire_number
+static bool put_fixed(const cpp_int& x, std::uint8_t* p, std::size_t width, std::vector<std::uint64_t>& words){
+    std::memset(p, 0, width);
+    if (x == 0) return true;
+    if (x < 0) return false;
+    std::size_t len = msb(x) / 8 + 1;
+    if (len > width) return false;
+    words.clear();
+    export_bits(x, std::back_inserter(words), 64, false);
+    for (std::size_t i = 0; i < len; ++i) p[width - 1 - i] = static_cast<std::uint8_t>(words[i / 8] >> (i % 8 * 8));
+    return true;
+}
+
+// Reads a width-byte big-endian field through 64-bit words, which import_bits takes far faster than single bytes
+void read_wire_number(cpp_int& x, const std::uint8_t* p, std::size_t width, std::vector<std::uint64_t>& words){
+    words.assign((width + 7) / 8, 0);
+    for (std::size_t i = 0; i < width; ++i){
+        std::size_t bit = (width - 1 - i) * 8;
+        words[bit / 64] |= std::uint64_t(p[i]) << (bit % 64);
+    }
+    import_bits(x, words.begin(), words.end(), 64, false);
+}
+
+std::size_t wire_bytes(const cpp_int& n){
+    return n == 0 ? 1 : msb(n) / 8 + 1;
+}
+
+bool is_binary_message(std::string_view data){
+    return data.size() >= sizeof(WIRE_MAGIC) && std::memcmp(data.data(), WIRE_MAGIC, sizeof(WIRE_MAGIC)) == 0;
+}
+
+bool parse_wire_header(std::string_view data, WireHeader& header){
+    if (data.size() < WIRE_HEADER_BYTES || !is_binary_message(data)) return false;
+    const std::uint8_t* p = reinterpret_cast<const std::uint8_t*>(data.data());
+    header.version = p[4];
+    header.mode = static_cast<CbcMode>(p[5]);
+    header.nonce_bytes = static_cast<std::uint16_t>(get_be(p + 6, 2));
+    header.block_bytes = static_cast<std::uint16_t>(get_be(p + 8, 2));
+    header.block_count = static_cast<std::uint32_t>(get_be(p + 12, 4));
+    if (header.version != WIRE_VERSION || p[5] > static_cast<std::uint8_t>(CbcMode::Envelope)) return false;
+    return get_be(p + 10, 2) == 0 && header.nonce_bytes != 0 && header.block_bytes != 0;
+}
+
+std::size_t binary_message_bytes(const WireHeader& header){
+    return WIRE_HEADER_BYTES + header.nonce_bytes + static_cast<std::size_t>(header.block_count) * header.block_bytes;
+}
+
+bool format_binary_message(CbcMode mode, const cpp_int& encrypted_nonce, std::span<const cpp_int> cipher,
+                           std::size_t nonce_bytes, std::size_t block_bytes, std::string& out){
+    if (nonce_bytes == 0 || nonce_bytes > 0xffff || block_bytes == 0 || block_bytes > 0xffff) return false;
+    if (cipher.size() > 0xffffffffu) return false;
+
+    out.resize(WIRE_HEADER_BYTES + nonce_bytes + cipher.size() * block_bytes);
+    std::uint8_t* p = reinterpret_cast<std::uint8_t*>(out.data());
+    std::memcpy(p, WIRE_MAGIC, sizeof(WIRE_MAGIC));
+    p[4] = WIRE_VERSION;
+    p[5] = static_cast<std::uint8_t>(mode);
+    put_be(p + 6, nonce_bytes, 2);
+    put_be(p + 8, block_bytes, 2);
+    put_be(p + 10, 0, 2);
+    put_be(p + 12, cipher.size(), 4);
+
+    p += WIRE_HEADER_BYTES;
+    std::vector<std::uint64_t> words;
+    bool fits = put_fixed(encrypted_nonce, p, nonce_bytes, words);
+    p += nonce_bytes;
+    for (std::size_t i = 0; fits && i < cipher.size(); ++i, p += block_bytes) fits = put_fixed(cipher[i], p, block_bytes, words);
+    if (!fits) out.clear(); // never leave a half-written message to be sent
+    return fits;
+}
+
+bool parse_binary_message(std::string_view data, CbcMode& mode, cpp_int& encrypted_nonce, std::vector<cpp_int>& cipher){
+    WireHeader header;
+    if (!parse_wire_header(data, header) || data.size() != binary_message_bytes(header)) return false;
+
+    const std::uint8_t* p = reinterpret_cast<const std::uint8_t*>(data.data()) + WIRE_HEADER_BYTES;
+    std::vector<std::uint64_t> words;
+    mode = header.mode;
+    read_wire_number(encrypted_nonce, p, header.nonce_bytes, words);
+    p += header.nonce_bytes;
+    cipher.resize(header.block_count);
+    for (cpp_int& block : cipher){
+        read_wire_number(block, p, header.block_bytes, words);
+        p += header.block_bytes;
+    }
+    return true;
+}
@@ -0,0 +1,71 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <boost/multiprecision/cpp_int.hpp>
+
+using namespace boost::multiprecision;
+
+// How a message's plaintext is laid out in RSA blocks
+enum class CbcMode : std::uint8_t {
+    Byte = 0,   // one byte per block, chained on prev % 256 (the original format)
+    Packed = 1, // as many bytes per block as fit below n, chained on the previous block
+    Segmented = 2, // packed blocks, chained separately in segments of CBC_SEGMENT_BLOCKS so they run in parallel
+    Envelope = 3,  // AES-128-CBC keyed from the nonce, RSA only carries the nonce (see envelope.h)
+};
+
+// How a message is encoded on the wire
+enum class WireFormat : std::uint8_t {
+    Text = 0,   // mode:nonce|c1,c2,... in decimal (the original format)
+    Binary = 1, // WIRE_MAGIC header, then fixed-width big-endian nonce and blocks
+};
+
+/*
+ * Binary message header, every integer big-endian:
+ *   0  magic 00 'R' 'C' 'B' (a text message always starts with a digit)
+ *   4  u8 version
+ *   5  u8 CbcMode
+ *   6  u16 nonce_bytes, the width of the encrypted nonce
+ *   8  u16 block_bytes, the width of every ciphertext block
+ *  10  u16 reserved, 0
+ *  12  u32 block_count
+ *  16  nonce, then block_count blocks
+ */
+constexpr std::uint8_t WIRE_MAGIC[4] = {0x00, 'R', 'C', 'B'};
+constexpr std::uint8_t WIRE_VERSION = 1;
+constexpr std::size_t WIRE_HEADER_BYTES = 16;
+
+struct WireHeader {
+    std::uint8_t version;
+    CbcMode mode;
+    std::uint16_t nonce_bytes;
+    std::uint16_t block_bytes;
+    std::uint32_t block_count;
+};
+
+// Line a client sends after the public key to ask what else the server supports; see format_capabilities()
+constexpr std::string_view CAPABILITY_REQUEST = "CAPS";
+constexpr int CAPABILITY_TIMEOUT_MS = 2000; // a server of the original protocol never answers the request
+
+std::string format_public_key(const cpp_int& e, const cpp_int& n);
+bool parse_public_key(const std::string& data, cpp_int& e, cpp_int& n);
+std::string format_capabilities(const std::vector<CbcMode>& modes, const std::vector<WireFormat>& formats);
+bool parse_capabilities(std::string_view data, std::vector<CbcMode>& modes, std::vector<WireFormat>& formats);
+std::string format_message(CbcMode mode, const cpp_int& encrypted_nonce, const std::vector<cpp_int>& cipher);
+bool parse_message(const std::string& data, CbcMode& mode, cpp_int& encrypted_nonce, std::vector<cpp_int>& cipher);
+
+std::size_t wire_bytes(const cpp_int& n);
+bool is_binary_message(std::string_view data);
+bool parse_wire_header(std::string_view data, WireHeader& header);
+std::size_t binary_message_bytes(const WireHeader& header);
+bool format_binary_message(CbcMode mode, const cpp_int& encrypted_nonce, std::span<const cpp_int> cipher,
+                           std::size_t nonce_bytes, std::size_t block_bytes, std::string& out);
+void read_wire_number(cpp_int& x, const std::uint8_t* p, std::size_t width, std::vector<std::uint64_t>& words);
+bool parse_binary_message(std::string_view data, CbcMode& mode, cpp_int& encrypted_nonce, std::vector<cpp_int>& cipher);
+
+#endif
@@ -1,6 +1,11 @@
 #ifndef RSA_CBC_H
 #define RSA_CBC_H
 
+#include <array>
+#include <cstdint>
+#include <span>
+#include <stop_token>
+#include <string_view>
 #include <vector>
 #include <string>
 #include <boost/multiprecision/cpp_int.hpp>
@@ -10,15 +15,137 @@
 using namespace boost::multiprecision;
 using namespace boost::random;
 
-cpp_int mod_exp(cpp_int base, cpp_int exp, cpp_int mod);
-cpp_int mod_inverse(cpp_int e, cpp_int phi);
-bool miller_rabin_test(cpp_int n, int k = 10);
+// Per-modulus constants for Montgomery multiplication, built once per key
+struct MontgomeryContext {
+    cpp_int n;
+    unsigned r_bits = 0;
+    cpp_int r_mask;
+    cpp_int n_prime;
+    cpp_int r2;
+    cpp_int one;
+};
+
+// One window of a recoded exponent: square this many times, then multiply by base^digit (digit is odd, or 0 for none)
+struct WindowStep {
+    std::uint32_t squarings;
+    std::uint32_t digit;
+};
+
+// Sliding-window recoding of a fixed exponent, worked out once per key
+struct WindowedExponent {
+    int window = 1;
+    std::vector<WindowStep> steps;
+};
+
+// Private key with the CRT parameters needed for fast decryption
+struct RsaPrivateKey {
+    cpp_int n, e, d;
+    cpp_int p, q;
+    cpp_int dp, dq, qinv;
+    WindowedExponent dp_win, dq_win;
+    MontgomeryContext mont_n, mont_p, mont_q;
+};
+
+// Primality test run on each prime candidate that survives the small-prime sieve
+enum class PrimalityTest {
+    MillerRabin,          // 10 random-base rounds, whatever the size
+    ScheduledMillerRabin, // base 2, then random bases up to miller_rabin_rounds(bits)
+    Bpsw,                 // base-2 strong test plus a strong Lucas test
+};
+
+// Every byte-mode CBC block encrypts a value in 0..255, so a public key has only 256 possible ciphertexts
+struct CbcCodebook {
+    std::array<cpp_int, 256> cipher;
+    std::array<std::uint8_t, 256> low_byte;
+};
+
+// Reverse of a CbcCodebook: open-addressing table from a ciphertext fingerprint to the byte it encrypts
+struct CbcIndexSlot {
+    std::uint64_t fingerprint;
+    std::uint16_t value; // 0..255, or CBC_INDEX_EMPTY
+};
+
+constexpr std::size_t CBC_INDEX_SLOTS = 512; // power of two, half full with 256 entries
+constexpr std::uint16_t CBC_INDEX_EMPTY = 0xffff;
+
+struct CbcDecryptIndex {
+    std::array<CbcIndexSlot, CBC_INDEX_SLOTS> slots;
+    CbcCodebook book;
+};
+
+// Messages shorter than this many blocks are decrypted on the calling thread; handing them to the pool costs more than it saves
+constexpr std::size_t CBC_PARALLEL_MIN_BLOCKS = 64;
+constexpr std::size_t CBC_PARALLEL_GRAIN = 32; // blocks per chunk, a multiple of the batch kernel's lane count
+constexpr std::size_t CBC_SEGMENT_BLOCKS = 32; // packed blocks per independently chained segment in segmented mode
+
+cpp_int mod_exp(const cpp_int& base, const cpp_int& exp, const cpp_int& mod);
+MontgomeryContext make_montgomery_context(const cpp_int& n);
+cpp_int montgomery_reduce(const cpp_int& t, const MontgomeryContext& ctx);
+cpp_int to_montgomery(const cpp_int& a, const MontgomeryContext& ctx);
+cpp_int from_montgomery(const cpp_int& a, const MontgomeryContext& ctx);
+cpp_int mod_exp(const cpp_int& base, const cpp_int& exp, const MontgomeryContext& ctx);
+int window_bits_for(std::size_t exp_bits);
+WindowedExponent recode_exponent(const cpp_int& exp);
+cpp_int mod_exp(const cpp_int& base, const WindowedExponent& exp, const MontgomeryContext& ctx);
+cpp_int mod_exp_small(const cpp_int& base, std::uint64_t exp, const MontgomeryContext& ctx);
+cpp_int mod_exp_65537(const cpp_int& base, const MontgomeryContext& ctx);
+cpp_int mod_inverse(const cpp_int& e, const cpp_int& phi);
+void mod_inverse_batch(std::span<const cpp_int> values, const cpp_int& m, std::span<cpp_int> out);
+std::vector<cpp_int> mod_inverse_batch(const std::vector<cpp_int>& values, const cpp_int& m);
+bool miller_rabin_test(const cpp_int& n, int k = 10);
+int miller_rabin_rounds(int bits);
+bool scheduled_miller_rabin_test(const cpp_int& n);
+bool bpsw_test(const cpp_int& n);
+bool is_probable_prime(const cpp_int& n, PrimalityTest test);
 cpp_int random_number(int bits);
-cpp_int generate_prime(int bits);
+cpp_int generate_prime(int bits, PrimalityTest test = PrimalityTest::Bpsw);
+cpp_int generate_prime(int bits, std::stop_token stop, PrimalityTest test = PrimalityTest::Bpsw);
+cpp_int generate_prime_parallel(int bits, unsigned threads, PrimalityTest test = PrimalityTest::Bpsw);
 void generate_rsa_keys(cpp_int& n, cpp_int& e, cpp_int& d, int bits);
-cpp_int rsa_encrypt(cpp_int m, cpp_int e, cpp_int n);
-cpp_int rsa_decrypt(cpp_int c, cpp_int d, cpp_int n);
-std::vector<cpp_int> cbc_encrypt(const std::string& plaintext, cpp_int e, cpp_int n, cpp_int iv);
-std::string cbc_decrypt(const std::vector<cpp_int>& cipher, cpp_int d, cpp_int n, cpp_int iv);
+RsaPrivateKey make_rsa_private_key(const cpp_int& p, const cpp_int& q, const cpp_int& e);
+void prepare_rsa_private_key(RsaPrivateKey& key);
+void generate_rsa_keys(RsaPrivateKey& key, int bits, PrimalityTest test = PrimalityTest::Bpsw);
+bool generate_rsa_keys(RsaPrivateKey& key, int bits, std::stop_token stop, PrimalityTest test = PrimalityTest::Bpsw);
+void generate_rsa_keys_parallel(RsaPrivateKey& key, int bits, unsigned threads, PrimalityTest test = PrimalityTest::Bpsw);
+cpp_int rsa_encrypt(const cpp_int& m, const cpp_int& e, const cpp_int& n);
+cpp_int rsa_decrypt(const cpp_int& c, const cpp_int& d, const cpp_int& n);
+std::vector<cpp_int> cbc_encrypt(const std::string& plaintext, const cpp_int& e, const cpp_int& n, const cpp_int& iv);
+std::string cbc_decrypt(const std::vector<cpp_int>& cipher, const cpp_int& d, const cpp_int& n, const cpp_int& iv);
+
+cpp_int rsa_encrypt(const cpp_int& m, const cpp_int& e, const MontgomeryContext& ctx);
+cpp_int rsa_decrypt(const cpp_int& c, const cpp_int& d, const MontgomeryContext& ctx);
+std::vector<cpp_int> cbc_encrypt(const std::string& plaintext, const cpp_int& e, const MontgomeryContext& ctx, const cpp_int& iv);
+std::string cbc_decrypt(const std::vector<cpp_int>& cipher, const cpp_int& d, const MontgomeryContext& ctx, const cpp_int& iv);
+
+std::size_t cbc_cipher_blocks(std::size_t plaintext_bytes);
+std::size_t cbc_plaintext_bytes(std::size_t cipher_blocks);
+std::size_t cbc_encrypt(std::string_view plaintext, const cpp_int& e, const MontgomeryContext& ctx, const cpp_int& iv, std::span<cpp_int> out);
+
+cpp_int rsa_decrypt(const cpp_int& c, const RsaPrivateKey& key);
+void rsa_decrypt_batch(std::span<const cpp_int> cipher, const RsaPrivateKey& key, std::span<cpp_int> out);
+std::string cbc_decrypt(const std::vector<cpp_int>& cipher, const RsaPrivateKey& key, const cpp_int& iv);
+std::string cbc_decrypt_parallel(const std::vector<cpp_int>& cipher, const RsaPrivateKey& key, const cpp_int& iv);
+std::size_t cbc_decrypt(std::span<const cpp_int> cipher, const RsaPrivateKey& key, const cpp_int& iv, std::span<char> out);
+
+std::vector<cpp_int> cbc_encrypt(const std::string& plaintext, const CbcCodebook& book, const cpp_int& iv);
+std::size_t cbc_encrypt(std::string_view plaintext, const CbcCodebook& book, const cpp_int& iv, std::span<cpp_int> out);
+std::uint64_t cipher_fingerprint(const cpp_int& c);
+CbcDecryptIndex make_cbc_decrypt_index(const CbcCodebook& book);
+int cbc_index_lookup(const CbcDecryptIndex& index, const cpp_int& c);
+std::string cbc_decrypt(const std::vector<cpp_int>& cipher, const CbcDecryptIndex& index, const RsaPrivateKey& key, const cpp_int& iv);
+
+std::size_t packed_block_bytes(const cpp_int& n);
+std::string packed_pad(const std::string& plaintext, std::size_t block_bytes);
+std::size_t packed_cipher_blocks(std::size_t plaintext_bytes, std::size_t block_bytes);
+std::size_t packed_plaintext_bytes(std::size_t cipher_blocks, std::size_t block_bytes);
+std::size_t packed_unpadded_size(std::string_view data);
+bool packed_unpad(std::string& data);
+std::vector<cpp_int> cbc_encrypt_packed(const std::string& plaintext, const cpp_int& e, const MontgomeryContext& ctx, const cpp_int& iv);
+std::string cbc_decrypt_packed(const std::vector<cpp_int>& cipher, const RsaPrivateKey& key, const cpp_int& iv);
+std::vector<cpp_int> cbc_encrypt_packed_blocks(const std::string& padded, const cpp_int& e, const MontgomeryContext& ctx, const cpp_int& iv);
+std::string cbc_decrypt_packed_blocks(const std::vector<cpp_int>& cipher, const RsaPrivateKey& key, const cpp_int& iv);
+std::size_t cbc_encrypt_packed_blocks(std::string_view padded, const cpp_int& e, const MontgomeryContext& ctx, const cpp_int& iv, std::span<cpp_int> out);
+std::size_t cbc_decrypt_packed_blocks(std::span<const cpp_int> cipher, const RsaPrivateKey& key, const cpp_int& iv, std::span<char> out);
+cpp_int segment_iv(const cpp_int& nonce, std::size_t index, std::size_t block_bytes);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,246 @@
+/*
+ *  File: rsa_engine.cpp
+ * Author: Johnny CW
+ * Date: October 16, 2026
+ * Picks the RSA engine matching a key's size at startup
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <boost/multiprecision/cpp_int.hpp>
+#include "rsa_engine.h"
+
+using namespace boost::multiprecision;
+
+
+/*
+ * Packed mode with padding
+ *
+ * Variables:
+ * whole: blocks filled entirely by plaintext, encrypted straight from the caller's buffer
+ * last: the final block, the plaintext tail followed by the padding, built in a stack buffer
+ *
+ * Purpose:
+ * Same output as padding the whole message with packed_pad first, without copying it.
+ * cbc_decrypt_packed writes every block into out and sets length to the size without the padding;
+ * it returns false if out is too small or the padding is invalid.
+ */
+std::size_t RsaEngineBase::cbc_encrypt_packed(std::string_view plaintext, const cpp_int& iv, std::span<cpp_int> out) const {
+    std::size_t k = block_bytes();
+    std::size_t blocks = packed_cipher_blocks(plaintext.size());
+    if (out.size() < blocks) return 0;
+    std::size_t whole = blocks - 1;
+    cbc_encrypt_packed_blocks(plaintext.substr(0, whole * k), iv, out);
+
+    std::array<char, 512> stack_block; // packed blocks of every fixed-width engine fit
+    std::string heap_block;
+    char* last = stack_block.data();
+    if (k > stack_block.size()){
+        heap_block.resize(k);
+        last = heap_block.data();
+    }
+    std::size_t tail = plaintext.size() - whole * k;
+    std::copy(plaintext.begin() + whole * k, plaintext.end(), last);
+    last[tail] = static_cast<char>(0x80);
+    std::fill(last + tail + 1, last + k, '\0');
+    cbc_encrypt_packed_blocks(std::string_view(last, k), whole == 0 ? iv : out[whole - 1], out.subspan(whole));
+    return blocks;
+}
+
+bool RsaEngineBase::cbc_decrypt_packed(std::span<const cpp_int> cipher, const cpp_int& iv, std::span<char> out, std::size_t& length) const {
+    std::size_t written = cbc_decrypt_packed_blocks(cipher, iv, out);
+    length = packed_unpadded_size(std::string_view(out.data(), written));
+    return length != std::string::npos;
+}
+
+
+/*
+ * Segmented mode
+ *
+ * Variables:
+ * segments: groups of CBC_SEGMENT_BLOCKS packed blocks, the last one possibly shorter
+ * segment_iv(nonce, s): the IV segment s is chained from
+ *
+ * Purpose:
+ * Packed CBC encryption is sequential because every block chains on the one before. Segmented mode restarts the
+ * chain at every segment, so segments are encrypted and decrypted in parallel on the shared thread pool.
+ * The padding and block count are the same as packed mode over the whole message, and the padding is in the
+ * last segment. Sizes come from packed_cipher_blocks and packed_plaintext_bytes.
+ */
+std::size_t RsaEngineBase::cbc_encrypt_segmented(std::string_view plaintext, const cpp_int& nonce, std::span<cpp_int> out) const {
+    std::size_t k = block_bytes();
+    std::size_t blocks = packed_cipher_blocks(plaintext.size());
+    if (out.size() < blocks) return 0;
+    std::size_t segments = (blocks + CBC_SEGMENT_BLOCKS - 1) / CBC_SEGMENT_BLOCKS;
+
+    shared_thread_pool().parallel_for(segments, 1, [&](std::size_t begin, std::size_t end){
+        for (std::size_t s = begin; s < end; ++s){
+            std::size_t first = s * CBC_SEGMENT_BLOCKS;
+            cpp_int iv = segment_iv(nonce, s, k);
+            if (s == segments - 1) cbc_encrypt_packed(plaintext.substr(first * k), iv, out.subspan(first));
+            else cbc_encrypt_packed_blocks(plaintext.substr(first * k, CBC_SEGMENT_BLOCKS * k), iv, out.subspan(first));
+        }
+    });
+    return blocks;
+}
+
+/*
+ * Encrypts whole segments without padding, segment first_segment onwards of a message, for callers that produce a
+ * message a few segments at a time (see CbcEncryptor). padded.size() must be a multiple of block_bytes(); a short
+ * final segment is allowed. Returns the blocks written, or 0 if out is too small.
+ */
+std::size_t RsaEngineBase::cbc_encrypt_segments(std::string_view padded, const cpp_int& nonce, std::size_t first_segment,
+                                                std::span<cpp_int> out) const {
+    std::size_t k = block_bytes();
+    std::size_t blocks = padded.size() / k;
+    if (out.size() < blocks) return 0;
+    std::size_t segments = (blocks + CBC_SEGMENT_BLOCKS - 1) / CBC_SEGMENT_BLOCKS;
+
+    shared_thread_pool().parallel_for(segments, 1, [&](std::size_t begin, std::size_t end){
+        for (std::size_t s = begin; s < end; ++s){
+            std::size_t first = s * CBC_SEGMENT_BLOCKS;
+            std::size_t count = std::min(CBC_SEGMENT_BLOCKS, blocks - first);
+            cbc_encrypt_packed_blocks(padded.substr(first * k, count * k), segment_iv(nonce, first_segment + s, k), out.subspan(first));
+        }
+    });
+    return blocks;
+}
+
+/*
+ * Decrypts whole segments without removing the padding, segment first_segment onwards of a message starting at
+ * cipher[0], for callers that receive a message a few segments at a time (see CbcDecryptor). Returns the bytes
+ * written, or 0 if out is too small or the engine has no private key.
+ */
+std::size_t RsaEngineBase::cbc_decrypt_segments(std::span<const cpp_int> cipher, const cpp_int& nonce, std::size_t first_segment,
+                                                std::span<char> out) const {
+    std::size_t k = block_bytes();
+    if (cipher.empty() || out.size() < packed_plaintext_bytes(cipher.size())) return 0;
+    std::size_t segments = (cipher.size() + CBC_SEGMENT_BLOCKS - 1) / CBC_SEGMENT_BLOCKS;
+
+    std::atomic<bool> failed{false};
+    shared_thread_pool().parallel_for(segments, 1, [&](std::size_t begin, std::size_t end){
+        for (std::size_t s = begin; s < end; ++s){
+            std::size_t first = s * CBC_SEGMENT_BLOCKS;
+            std::size_t count = std::min(CBC_SEGMENT_BLOCKS, cipher.size() - first);
+            if (cbc_decrypt_packed_blocks(cipher.subspan(first, count), segment_iv(nonce, first_segment + s, k), out.subspan(first * k)) == 0){
+                failed = true; // engine without a private key
+            }
+        }
+    });
+    return failed ? 0 : cipher.size() * k;
+}
+
+bool RsaEngineBase::cbc_decrypt_segmented(std::span<const cpp_int> cipher, const cpp_int& nonce, std::span<char> out, std::size_t& length) const {
+    length = 0;
+    std::size_t written = cbc_decrypt_segments(cipher, nonce, 0, out);
+    if (written == 0) return false;
+    length = packed_unpadded_size(std::string_view(out.data(), written));
+    return length != std::string::npos;
+}
+
+
+/*
+ * Versions that allocate their result, for callers that do not keep buffers around
+ */
+std::vector<cpp_int> RsaEngineBase::cbc_encrypt(const std::string& plaintext, const cpp_int& iv) const {
+    std::vector<cpp_int> cipher(cbc_cipher_blocks(plaintext.size()));
+    cbc_encrypt(plaintext, iv, cipher);
+    return cipher;
+}
+
+std::string RsaEngineBase::cbc_decrypt(const std::vector<cpp_int>& cipher, const cpp_int& iv) const {
+    std::string plaintext(cbc_plaintext_bytes(cipher.size()), '\0');
+    plaintext.resize(cbc_decrypt(cipher, iv, plaintext));
+    return plaintext;
+}
+
+std::vector<cpp_int> RsaEngineBase::cbc_encrypt_packed(const std::string& plaintext, const cpp_int& iv) const {
+    std::vector<cpp_int> cipher(packed_cipher_blocks(plaintext.size()));
+    cbc_encrypt_packed(plaintext, iv, cipher);
+    return cipher;
+}
+
+std::string RsaEngineBase::cbc_decrypt_packed(const std::vector<cpp_int>& cipher, const cpp_int& iv) const {
+    std::string plaintext(packed_plaintext_bytes(cipher.size()), '\0');
+    std::size_t length;
+    if (!cbc_decrypt_packed(cipher, iv, plaintext, length)) return std::string();
+    plaintext.resize(length);
+    return plaintext;
+}
+
+std::vector<cpp_int> RsaEngineBase::cbc_encrypt_segmented(const std::string& plaintext, const cpp_int& nonce) const {
+    std::vector<cpp_int> cipher(packed_cipher_blocks(plaintext.size()));
+    cbc_encrypt_segmented(plaintext, nonce, cipher);
+    return cipher;
+}
+
+std::string RsaEngineBase::cbc_decrypt_segmented(const std::vector<cpp_int>& cipher, const cpp_int& nonce) const {
+    std::string plaintext(packed_plaintext_bytes(cipher.size()), '\0');
+    std::size_t length;
+    if (!cbc_decrypt_segmented(cipher, nonce, plaintext, length)) return std::string();
+    plaintext.resize(length);
+    return plaintext;
+}
+
+std::vector<cpp_int> RsaEngineBase::cbc_encrypt_packed_blocks(const std::string& padded, const cpp_int& iv) const {
+    std::vector<cpp_int> cipher(padded.size() / block_bytes());
+    cbc_encrypt_packed_blocks(padded, iv, cipher);
+    return cipher;
+}
+
+std::string RsaEngineBase::cbc_decrypt_packed_blocks(const std::vector<cpp_int>& cipher, const cpp_int& iv) const {
+    std::string plaintext(packed_plaintext_bytes(cipher.size()), '\0');
+    plaintext.resize(cbc_decrypt_packed_blocks(cipher, iv, plaintext));
+    return plaintext;
+}
+
+
+/*
+ * Engine Selection
+ *
+ * Variables:
+ * n_bits: bit length of the modulus
+ * half_bits: bit length of the larger prime (0 for a public-only key)
+ *
+ * Purpose:
+ * Returns the smallest fixed-width engine that the key fits in, so a 512-bit server key runs on RsaEngine<512>.
+ * Keys that fit none of the compiled sizes fall back to the cpp_int reference engine.
+ * Returns nullptr for a modulus below 2^8, whose packed block size would be 0.
+ */
+template <class... Args>
+static std::unique_ptr<RsaEngineBase> select_engine(std::size_t n_bits, std::size_t half_bits, const Args&... args){
+    if (n_bits <= 512 && half_bits <= 256) return std::make_unique<RsaEngine<512>>(args...);
+    if (n_bits <= 1024 && half_bits <= 512) return std::make_unique<RsaEngine<1024>>(args...);
+    if (n_bits <= 2048 && half_bits <= 1024) return std::make_unique<RsaEngine<2048>>(args...);
+    if (n_bits <= 4096 && half_bits <= 2048) return std::make_unique<RsaEngine<4096>>(args...);
+    return std::make_unique<ReferenceRsaEngine>(args...);
+}
+
+std::unique_ptr<RsaEngineBase> make_rsa_engine(const cpp_int& e, const cpp_int& n){
+    if (n <= 0 || packed_block_bytes(n) == 0) return nullptr;
+    if (n % 2 == 0) return std::make_unique<ReferenceRsaEngine>(e, n); // Montgomery needs an odd modulus
+    return select_engine(msb(n) + 1, 0, e, n);
+}
+
+std::unique_ptr<RsaEngineBase> make_rsa_engine(const RsaPrivateKey& key){
+    if (key.n <= 0 || packed_block_bytes(key.n) == 0) return nullptr;
+    std::size_t half_bits = std::max(msb(key.p), msb(key.q)) + 1;
+    return select_engine(msb(key.n) + 1, half_bits, key);
+}
+
+
+/*
+ * Codebook Construction
+ *
+ * Encrypts all 256 byte values once with the engine's public key, for cbc_encrypt(plaintext, book, iv).
+ */
+CbcCodebook make_cbc_codebook(const RsaEngineBase& engine){
+    CbcCodebook book;
+    for (unsigned x = 0; x < 256; ++x){
+        book.cipher[x] = engine.encrypt(x);
+        book.low_byte[x] = static_cast<std::uint8_t>(low_byte(book.cipher[x]));
+    }
+    return book;
+}
@@ -0,0 +1,685 @@
+#ifndef RSA_ENGINE_H
+#define RSA_ENGINE_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <boost/multiprecision/cpp_int.hpp>
+#include "rsa_cbc.h"
+#include "mod_exp_batch.h"
+#include "thread_pool.h"
+
+#if defined _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace boost::multiprecision;
+
+// Little-endian array of 64-bit limbs, the storage for every fixed-width number
+template <std::size_t N>
+using Limbs = std::array<std::uint64_t, N>;
+
+
+/*
+ * Limb primitives
+ *
+ * limb_mac: returns the low word of a*b + t + carry and leaves the high word in carry
+ * limb_add: returns a + b + carry and leaves the carry-out (0 or 1) in carry
+ * limb_sub: returns a - b - borrow and leaves the borrow-out (0 or 1) in borrow
+ */
+inline std::uint64_t limb_mac(std::uint64_t a, std::uint64_t b, std::uint64_t t, std::uint64_t& carry){
+#if defined _MSC_VER
+    std::uint64_t hi;
+    std::uint64_t lo = _umul128(a, b, &hi);
+    hi += _addcarry_u64(0, lo, t, &lo);
+    hi += _addcarry_u64(0, lo, carry, &lo);
+    carry = hi;
+    return lo;
+#else
+    unsigned __int128 r = static_cast<unsigned __int128>(a) * b + t + carry;
+    carry = static_cast<std::uint64_t>(r >> 64);
+    return static_cast<std::uint64_t>(r);
+#endif
+}
+
+inline std::uint64_t limb_add(std::uint64_t a, std::uint64_t b, std::uint64_t& carry){
+    std::uint64_t s = a + b;
+    std::uint64_t c = s < a;
+    std::uint64_t r = s + carry;
+    carry = c | (r < s);
+    return r;
+}
+
+inline std::uint64_t limb_sub(std::uint64_t a, std::uint64_t b, std::uint64_t& borrow){
+    std::uint64_t d = a - b;
+    std::uint64_t c = a < b;
+    std::uint64_t r = d - borrow;
+    borrow = c | (d < borrow);
+    return r;
+}
+
+
+/*
+ * Calls f(0), f(1), ..., f(N-1) as a fold expression, so the loop is unrolled at compile time
+ * instead of being left to the optimizer.
+ */
+template <std::size_t N, class F>
+inline void unrolled_for(F&& f){
+    [&]<std::size_t... I>(std::index_sequence<I...>){
+        (f(I), ...);
+    }(std::make_index_sequence<N>{});
+}
+
+
+/*
+ * Conversions between cpp_int and fixed-width limbs. x must be non-negative and below 2^(64*N).
+ */
+template <std::size_t N>
+Limbs<N> to_limbs(const cpp_int& x){
+    Limbs<N> out{};
+    if constexpr (sizeof(limb_type) == sizeof(std::uint64_t)){
+        const auto& b = x.backend();
+        std::copy(b.limbs(), b.limbs() + std::min<std::size_t>(b.size(), N), out.begin());
+    } else {
+        std::vector<std::uint64_t> words;
+        export_bits(x, std::back_inserter(words), 64, false);
+        std::copy(words.begin(), words.begin() + std::min(words.size(), N), out.begin());
+    }
+    return out;
+}
+
+// Overwrites x in place, so a cpp_int that already has room for N limbs is not reallocated
+template <std::size_t N>
+void assign_limbs(cpp_int& x, const Limbs<N>& a){
+    import_bits(x, a.begin(), a.end(), 64, false);
+}
+
+template <std::size_t N>
+cpp_int from_limbs(const Limbs<N>& a){
+    cpp_int x;
+    assign_limbs(x, a);
+    return x;
+}
+
+// x mod 256 without going through cpp_int arithmetic
+inline std::uint64_t low_byte(const cpp_int& x){
+    return static_cast<std::uint64_t>(*x.backend().limbs()) & 0xff;
+}
+
+template <std::size_t N>
+bool limbs_less(const Limbs<N>& a, const Limbs<N>& b){
+    for (std::size_t i = N; i-- > 0;){
+        if (a[i] != b[i]) return a[i] < b[i];
+    }
+    return false;
+}
+
+// a -= b, returns the borrow-out
+template <std::size_t N>
+std::uint64_t limbs_sub(Limbs<N>& a, const Limbs<N>& b){
+    std::uint64_t borrow = 0;
+    unrolled_for<N>([&](std::size_t i){ a[i] = limb_sub(a[i], b[i], borrow); });
+    return borrow;
+}
+
+// a += b, returns the carry-out
+template <std::size_t N>
+std::uint64_t limbs_add(Limbs<N>& a, const Limbs<N>& b){
+    std::uint64_t carry = 0;
+    unrolled_for<N>([&](std::size_t i){ a[i] = limb_add(a[i], b[i], carry); });
+    return carry;
+}
+
+// Full product a*b
+template <std::size_t N>
+Limbs<2 * N> limbs_mul(const Limbs<N>& a, const Limbs<N>& b){
+    Limbs<2 * N> t{};
+    for (std::size_t i = 0; i < N; ++i){
+        std::uint64_t carry = 0;
+        unrolled_for<N>([&](std::size_t j){ t[i + j] = limb_mac(a[j], b[i], t[i + j], carry); });
+        t[i + N] = carry;
+    }
+    return t;
+}
+
+
+/*
+ * Fixed-width Montgomery arithmetic
+ *
+ * Variables:
+ * n: the odd modulus, N limbs wide
+ * n0: -n^-1 mod 2^64, the per-word reduction constant
+ * r2, r3: R^2 mod n and R^3 mod n with R = 2^(64*N)
+ * one: R mod n, the Montgomery form of 1
+ *
+ * Purpose:
+ * Same role as MontgomeryContext, but every value lives in a stack array of N limbs, so multiplying, reducing
+ * and exponentiating never touches the heap. mul() is the CIOS (coarsely integrated operand scanning) method.
+ */
+template <std::size_t N>
+class MontgomeryField {
+public:
+    using Int = Limbs<N>;
+    static constexpr int MAX_WINDOW = 6; // largest width window_bits_for() returns
+
+    MontgomeryField() = default;
+
+    explicit MontgomeryField(const cpp_int& modulus){
+        n_ = to_limbs<N>(modulus);
+        std::uint64_t inv = 1;
+        for (int i = 0; i < 6; ++i) inv *= 2 - n_[0] * inv; // Newton iteration, doubles the correct bits each step
+        n0_ = 0 - inv;
+        cpp_int r = cpp_int(1) << (64 * N);
+        r2_ = to_limbs<N>((r * r) % modulus);
+        r3_ = to_limbs<N>((r * r * r) % modulus);
+        one_ = to_limbs<N>(r % modulus);
+    }
+
+    const Int& modulus() const { return n_; }
+    const Int& one() const { return one_; }
+
+    // a * b * R^-1 mod n, for a < R and b < n
+    Int mul(const Int& a, const Int& b) const {
+        std::array<std::uint64_t, N + 2> t{};
+        for (std::size_t i = 0; i < N; ++i){
+            std::uint64_t carry = 0;
+            unrolled_for<N>([&](std::size_t j){ t[j] = limb_mac(a[j], b[i], t[j], carry); });
+            std::uint64_t c2 = 0;
+            t[N] = limb_add(t[N], carry, c2);
+            t[N + 1] = c2;
+
+            std::uint64_t m = t[0] * n0_;
+            carry = 0;
+            limb_mac(m, n_[0], t[0], carry);
+            unrolled_for<N - 1>([&](std::size_t j){ t[j] = limb_mac(m, n_[j + 1], t[j + 1], carry); });
+            c2 = 0;
+            t[N - 1] = limb_add(t[N], carry, c2);
+            t[N] = t[N + 1] + c2;
+        }
+        Int r;
+        std::copy(t.begin(), t.begin() + N, r.begin());
+        if (t[N] != 0 || !limbs_less(r, n_)) limbs_sub(r, n_);
+        return r;
+    }
+
+    // t * R^-1 mod n for a double-width t < n * R
+    Int reduce(const Limbs<2 * N>& wide) const {
+        std::array<std::uint64_t, 2 * N + 1> t{};
+        std::copy(wide.begin(), wide.end(), t.begin());
+        for (std::size_t i = 0; i < N; ++i){
+            std::uint64_t m = t[i] * n0_;
+            std::uint64_t carry = 0;
+            unrolled_for<N>([&](std::size_t j){ t[i + j] = limb_mac(m, n_[j], t[i + j], carry); });
+            for (std::size_t k = i + N; carry != 0 && k <= 2 * N; ++k){
+                std::uint64_t c = 0;
+                t[k] = limb_add(t[k], carry, c);
+                carry = c;
+            }
+        }
+        Int r;
+        std::copy(t.begin() + N, t.begin() + 2 * N, r.begin());
+        if (t[2 * N] != 0 || !limbs_less(r, n_)) limbs_sub(r, n_);
+        return r;
+    }
+
+    Int to_mont(const Int& a) const { return mul(a, r2_); }
+
+    // Montgomery form of a double-width value below n * R (e.g. a full-size ciphertext reduced modulo one prime)
+    Int to_mont(const Limbs<2 * N>& wide) const { return mul(reduce(wide), r3_); }
+
+    // The same double-width value reduced modulo n, in normal form
+    Int reduce_wide(const Limbs<2 * N>& wide) const { return mul(reduce(wide), r2_); }
+
+    Int from_mont(const Int& a) const {
+        Int unit{};
+        unit[0] = 1;
+        return mul(a, unit);
+    }
+
+    // base^exp in Montgomery form, left-to-right binary
+    template <std::size_t M>
+    Int pow(const Int& base, const Limbs<M>& exp) const {
+        Int x = one_;
+        std::size_t top = M * 64;
+        while (top > 0 && ((exp[(top - 1) / 64] >> ((top - 1) % 64)) & 1) == 0) --top;
+        for (std::size_t i = top; i-- > 0;){
+            x = mul(x, x);
+            if ((exp[i / 64] >> (i % 64)) & 1) x = mul(x, base);
+        }
+        return x;
+    }
+
+    // base^exp in Montgomery form for a recoded exponent, as mod_exp(base, exp, ctx) does it for cpp_int
+    Int pow(const Int& base, const WindowedExponent& exp) const {
+        if (exp.steps.empty()) return one_;
+        std::array<Int, std::size_t(1) << (MAX_WINDOW - 1)> table;
+        table[0] = base;
+        Int base_sq = mul(base, base);
+        std::size_t entries = std::size_t(1) << (exp.window - 1);
+        for (std::size_t k = 1; k < entries; ++k) table[k] = mul(table[k - 1], base_sq);
+
+        Int x = table[exp.steps[0].digit >> 1];
+        for (std::size_t k = 1; k < exp.steps.size(); ++k){
+            for (std::uint32_t sq = 0; sq < exp.steps[k].squarings; ++sq) x = mul(x, x);
+            if (exp.steps[k].digit != 0) x = mul(x, table[exp.steps[k].digit >> 1]);
+        }
+        return x;
+    }
+
+    /*
+     * Lane-interleaved exponentiation
+     *
+     * Raises count <= L independent bases to the same recoded exponent. All lanes follow one shared schedule of
+     * squarings and table multiplies, and each step is issued for every lane back to back, so the CPU can overlap
+     * the lanes' independent carry chains instead of waiting on one chain at a time.
+     */
+    template <std::size_t L>
+    void pow_lanes(const Int* base, Int* out, std::size_t count, const WindowedExponent& exp) const {
+        if (exp.steps.empty()){
+            for (std::size_t l = 0; l < count; ++l) out[l] = one_;
+            return;
+        }
+        std::array<std::array<Int, L>, std::size_t(1) << (MAX_WINDOW - 1)> table;
+        std::array<Int, L> base_sq;
+        for (std::size_t l = 0; l < count; ++l){
+            table[0][l] = base[l];
+            base_sq[l] = mul(base[l], base[l]);
+        }
+        std::size_t entries = std::size_t(1) << (exp.window - 1);
+        for (std::size_t k = 1; k < entries; ++k){
+            for (std::size_t l = 0; l < count; ++l) table[k][l] = mul(table[k - 1][l], base_sq[l]);
+        }
+
+        std::array<Int, L> x = table[exp.steps[0].digit >> 1];
+        for (std::size_t k = 1; k < exp.steps.size(); ++k){
+            for (std::uint32_t sq = 0; sq < exp.steps[k].squarings; ++sq){
+                for (std::size_t l = 0; l < count; ++l) x[l] = mul(x[l], x[l]);
+            }
+            if (exp.steps[k].digit != 0){
+                const std::array<Int, L>& entry = table[exp.steps[k].digit >> 1];
+                for (std::size_t l = 0; l < count; ++l) x[l] = mul(x[l], entry[l]);
+            }
+        }
+        std::copy(x.begin(), x.begin() + count, out);
+    }
+
+    // base^exp in Montgomery form for an exponent that fits in one word, starting from the top set bit
+    Int pow_small(const Int& base, std::uint64_t exp) const {
+        if (exp == 0) return one_;
+        Int x = base;
+        int top = 63;
+        while (((exp >> top) & 1) == 0) --top;
+        for (int i = top - 1; i >= 0; --i){
+            x = mul(x, x);
+            if ((exp >> i) & 1) x = mul(x, base);
+        }
+        return x;
+    }
+
+    // base^65537 in Montgomery form: 65537 = 2^16 + 1, so 16 squarings and one multiply
+    Int pow_65537(const Int& base) const {
+        Int x = base;
+        for (int i = 0; i < 16; ++i) x = mul(x, x);
+        return mul(x, base);
+    }
+
+private:
+    Int n_{};
+    std::uint64_t n0_ = 0;
+    Int r2_{};
+    Int r3_{};
+    Int one_{};
+};
+
+
+/*
+ * RSA Engine interface
+ *
+ * Lets main() pick an implementation once from the key size and then call it without caring which one it got.
+ * decrypt() and cbc_decrypt() are only valid for engines built from a private key.
+ *
+ * Implementations provide the CBC primitives that write into caller buffers (see CBC into caller buffers in
+ * rsa_cbc.cpp for the sizes and return values); the padded packed mode and the versions that return a fresh
+ * vector or string are built on top of them here.
+ */
+class RsaEngineBase {
+public:
+    virtual ~RsaEngineBase() = default;
+    virtual std::size_t bits() const = 0;
+    virtual std::size_t block_bytes() const = 0;
+    virtual cpp_int encrypt(const cpp_int& m) const = 0;
+    virtual cpp_int decrypt(const cpp_int& c) const = 0;
+
+    virtual std::size_t cbc_encrypt(std::string_view plaintext, const cpp_int& iv, std::span<cpp_int> out) const = 0;
+    virtual std::size_t cbc_decrypt(std::span<const cpp_int> cipher, const cpp_int& iv, std::span<char> out) const = 0;
+    // Packed mode without the padding step, for callers that chain several calls (see cbc_stream.h)
+    virtual std::size_t cbc_encrypt_packed_blocks(std::string_view padded, const cpp_int& iv, std::span<cpp_int> out) const = 0;
+    virtual std::size_t cbc_decrypt_packed_blocks(std::span<const cpp_int> cipher, const cpp_int& iv, std::span<char> out) const = 0;
+
+    std::size_t packed_cipher_blocks(std::size_t plaintext_bytes) const { return ::packed_cipher_blocks(plaintext_bytes, block_bytes()); }
+    std::size_t packed_plaintext_bytes(std::size_t cipher_blocks) const { return ::packed_plaintext_bytes(cipher_blocks, block_bytes()); }
+    std::size_t cbc_encrypt_packed(std::string_view plaintext, const cpp_int& iv, std::span<cpp_int> out) const;
+    bool cbc_decrypt_packed(std::span<const cpp_int> cipher, const cpp_int& iv, std::span<char> out, std::size_t& length) const;
+    std::size_t cbc_encrypt_segmented(std::string_view plaintext, const cpp_int& nonce, std::span<cpp_int> out) const;
+    bool cbc_decrypt_segmented(std::span<const cpp_int> cipher, const cpp_int& nonce, std::span<char> out, std::size_t& length) const;
+    std::size_t cbc_encrypt_segments(std::string_view padded, const cpp_int& nonce, std::size_t first_segment, std::span<cpp_int> out) const;
+    std::size_t cbc_decrypt_segments(std::span<const cpp_int> cipher, const cpp_int& nonce, std::size_t first_segment, std::span<char> out) const;
+
+    std::vector<cpp_int> cbc_encrypt(const std::string& plaintext, const cpp_int& iv) const;
+    std::string cbc_decrypt(const std::vector<cpp_int>& cipher, const cpp_int& iv) const;
+    std::vector<cpp_int> cbc_encrypt_packed(const std::string& plaintext, const cpp_int& iv) const;
+    std::string cbc_decrypt_packed(const std::vector<cpp_int>& cipher, const cpp_int& iv) const;
+    std::vector<cpp_int> cbc_encrypt_segmented(const std::string& plaintext, const cpp_int& nonce) const;
+    std::string cbc_decrypt_segmented(const std::vector<cpp_int>& cipher, const cpp_int& nonce) const;
+    std::vector<cpp_int> cbc_encrypt_packed_blocks(const std::string& padded, const cpp_int& iv) const;
+    std::string cbc_decrypt_packed_blocks(const std::vector<cpp_int>& cipher, const cpp_int& iv) const;
+};
+
+
+/*
+ * Reference engine on top of the cpp_int functions in rsa_cbc.h, used for key sizes without a fixed-width engine.
+ */
+class ReferenceRsaEngine final : public RsaEngineBase {
+public:
+    using RsaEngineBase::cbc_encrypt;
+    using RsaEngineBase::cbc_decrypt;
+    using RsaEngineBase::cbc_encrypt_packed_blocks;
+    using RsaEngineBase::cbc_decrypt_packed_blocks;
+
+    ReferenceRsaEngine(const cpp_int& e, const cpp_int& n) : e_(e), ctx_(make_montgomery_context(n)) {}
+    explicit ReferenceRsaEngine(const RsaPrivateKey& key) : e_(key.e), ctx_(key.mont_n), key_(key), has_private_(true) {}
+
+    std::size_t bits() const override { return static_cast<std::size_t>(msb(ctx_.n) + 1); }
+    std::size_t block_bytes() const override { return packed_block_bytes(ctx_.n); }
+    cpp_int encrypt(const cpp_int& m) const override { return rsa_encrypt(m, e_, ctx_); }
+    cpp_int decrypt(const cpp_int& c) const override { return has_private_ ? rsa_decrypt(c, key_) : cpp_int(0); }
+
+    std::size_t cbc_encrypt(std::string_view plaintext, const cpp_int& iv, std::span<cpp_int> out) const override {
+        return ::cbc_encrypt(plaintext, e_, ctx_, iv, out);
+    }
+
+    std::size_t cbc_decrypt(std::span<const cpp_int> cipher, const cpp_int& iv, std::span<char> out) const override {
+        return has_private_ ? ::cbc_decrypt(cipher, key_, iv, out) : 0;
+    }
+
+    std::size_t cbc_encrypt_packed_blocks(std::string_view padded, const cpp_int& iv, std::span<cpp_int> out) const override {
+        return ::cbc_encrypt_packed_blocks(padded, e_, ctx_, iv, out);
+    }
+
+    std::size_t cbc_decrypt_packed_blocks(std::span<const cpp_int> cipher, const cpp_int& iv, std::span<char> out) const override {
+        return has_private_ ? ::cbc_decrypt_packed_blocks(cipher, key_, iv, out) : 0;
+    }
+
+private:
+    cpp_int e_;
+    MontgomeryContext ctx_;
+    RsaPrivateKey key_;
+    bool has_private_ = false;
+};
+
+
+/*
+ * Fixed-width RSA Engine
+ *
+ * Variables:
+ * Bits: key size the engine is compiled for; n must fit in Bits and p, q in Bits/2
+ * field_n: Montgomery arithmetic modulo n, used for encryption
+ * field_p, field_q: half-width Montgomery arithmetic modulo p and q, used for CRT decryption
+ * qinv: q^-1 mod p in Montgomery form
+ * block_bytes, mask: packed mode block size and the matching low-bits mask
+ * dp, dq: the key's sliding-window recodings of the CRT exponents
+ * simd_p, simd_q: constants for the vector batch kernel, left unusable when the CPU lacks it
+ *
+ * Purpose:
+ * Same results as the cpp_int reference path, but every block is processed in stack arrays whose loop bounds are
+ * known at compile time, so the hot loop in cbc_encrypt/cbc_decrypt does no heap allocation except for the cpp_int
+ * values it hands back to the caller.
+ */
+template <std::size_t Bits>
+class RsaEngine final : public RsaEngineBase {
+public:
+    static constexpr std::size_t N = Bits / 64;
+    static constexpr std::size_t H = N / 2;
+
+    using RsaEngineBase::cbc_encrypt;
+    using RsaEngineBase::cbc_decrypt;
+    using RsaEngineBase::cbc_encrypt_packed_blocks;
+    using RsaEngineBase::cbc_decrypt_packed_blocks;
+
+    RsaEngine(const cpp_int& e, const cpp_int& n)
+        : n_(n), field_n_(n), e_(to_limbs<N>(e)), e_small_(small_exponent(e)),
+          block_bytes_(packed_block_bytes(n)), mask_(block_mask(block_bytes_)) {}
+
+    explicit RsaEngine(const RsaPrivateKey& key)
+        : n_(key.n), field_n_(key.n), e_(to_limbs<N>(key.e)), e_small_(small_exponent(key.e)),
+          block_bytes_(packed_block_bytes(key.n)), mask_(block_mask(block_bytes_)),
+          field_p_(key.p), field_q_(key.q),
+          p_(to_limbs<H>(key.p)), q_(to_limbs<H>(key.q)),
+          dp_(key.dp_win), dq_(key.dq_win),
+          has_private_(true){
+        qinv_ = field_p_.to_mont(to_limbs<H>(key.qinv));
+        if (simd_batch_available()){
+            simd_p_ = make_simd_modulus(key.p);
+            simd_q_ = make_simd_modulus(key.q);
+        }
+    }
+
+    std::size_t bits() const override { return Bits; }
+    std::size_t block_bytes() const override { return block_bytes_; }
+
+    /*
+     * Public exponents that fit in one word (in practice always 65537) skip the generic ladder over all N limbs of e.
+     */
+    Limbs<N> encrypt_block(const Limbs<N>& m) const {
+        Limbs<N> a = field_n_.to_mont(m);
+        Limbs<N> x;
+        if (e_small_ == 65537) x = field_n_.pow_65537(a);
+        else if (e_small_ != 0) x = field_n_.pow_small(a, e_small_);
+        else x = field_n_.pow(a, e_);
+        return field_n_.from_mont(x);
+    }
+
+    /*
+     * CRT decryption, as in rsa_decrypt(c, key): c is reduced into both half-width fields directly
+     * from its full width, and Garner's recombination is done with a half-width multiply.
+     */
+    Limbs<N> decrypt_block(const Limbs<N>& c) const {
+        Limbs<H> m1 = field_p_.from_mont(field_p_.pow(field_p_.to_mont(c), dp_));
+        Limbs<H> m2 = field_q_.from_mont(field_q_.pow(field_q_.to_mont(c), dq_));
+        return crt_combine(m1, m2);
+    }
+
+    /*
+     * Batched CRT decryption
+     *
+     * Decrypts count independent blocks BATCH_LANES at a time. Both half-size exponentiations of a group run in
+     * lockstep across lanes: on the AVX-512 IFMA kernel when the CPU supports it, otherwise on the interleaved
+     * scalar kernel.
+     */
+    void decrypt_blocks(const Limbs<N>* c, Limbs<N>* x, std::size_t count) const {
+        for (std::size_t i = 0; i < count; i += BATCH_LANES){
+            std::size_t lanes = std::min(BATCH_LANES, count - i);
+            Limbs<H> m1[BATCH_LANES], m2[BATCH_LANES];
+            half_pow_lanes(field_p_, simd_p_, dp_, c + i, m1, lanes);
+            half_pow_lanes(field_q_, simd_q_, dq_, c + i, m2, lanes);
+            for (std::size_t l = 0; l < lanes; ++l) x[i + l] = crt_combine(m1[l], m2[l]);
+        }
+    }
+
+    cpp_int encrypt(const cpp_int& m) const override {
+        return from_limbs(encrypt_block(load(m)));
+    }
+
+    cpp_int decrypt(const cpp_int& c) const override {
+        if (!has_private_) return 0;
+        return from_limbs(decrypt_block(load(c)));
+    }
+
+    std::size_t cbc_encrypt(std::string_view plaintext, const cpp_int& iv, std::span<cpp_int> out) const override {
+        if (out.size() < cbc_cipher_blocks(plaintext.size())) return 0;
+        std::uint64_t prev = low_byte(iv);
+        for (std::size_t i = 0; i < plaintext.size(); ++i){
+            Limbs<N> x{};
+            x[0] = static_cast<unsigned char>(plaintext[i]) ^ prev; // XOR with previous ciphertext
+            Limbs<N> c = encrypt_block(x);
+            assign_limbs(out[i], c);
+            prev = c[0] & 0xff;
+        }
+        return plaintext.size();
+    }
+
+    // Every block only needs its own ciphertext to decrypt, so they all go through the batch path first
+    std::size_t cbc_decrypt(std::span<const cpp_int> cipher, const cpp_int& iv, std::span<char> out) const override {
+        if (!has_private_ || out.size() < cbc_plaintext_bytes(cipher.size())) return 0;
+        for_each_batch(cipher, [&](std::size_t i, const Limbs<N>& x){
+            std::uint64_t prev = low_byte(i == 0 ? iv : cipher[i - 1]);
+            out[i] = static_cast<char>((x[0] ^ prev) & 0xff);
+        });
+        return cipher.size();
+    }
+
+    // Packed mode, see cbc_encrypt_packed in rsa_cbc.cpp
+    std::size_t cbc_encrypt_packed_blocks(std::string_view padded, const cpp_int& iv, std::span<cpp_int> out) const override {
+        std::size_t blocks = padded.size() / block_bytes_;
+        if (out.size() < blocks) return 0;
+        Limbs<N> prev = to_limbs<N>(iv);
+        for (std::size_t i = 0; i < blocks; ++i){
+            Limbs<N> x = bytes_to_limbs(padded.data() + i * block_bytes_);
+            for (std::size_t j = 0; j < N; ++j) x[j] ^= prev[j] & mask_[j];
+            prev = encrypt_block(x);
+            assign_limbs(out[i], prev);
+        }
+        return blocks;
+    }
+
+    // Packed mode, see cbc_decrypt_packed in rsa_cbc.cpp; the blocks are independent so they go through the batch path
+    std::size_t cbc_decrypt_packed_blocks(std::span<const cpp_int> cipher, const cpp_int& iv, std::span<char> out) const override {
+        if (!has_private_ || out.size() < packed_plaintext_bytes(cipher.size())) return 0;
+        for_each_batch(cipher, [&](std::size_t i, const Limbs<N>& x){
+            Limbs<N> prev = to_limbs<N>(i == 0 ? iv : cipher[i - 1]);
+            Limbs<N> m = x;
+            for (std::size_t j = 0; j < N; ++j) m[j] = (m[j] ^ prev[j]) & mask_[j];
+            limbs_to_bytes(m, out.data() + i * block_bytes_);
+        });
+        return cipher.size() * block_bytes_;
+    }
+
+private:
+    // block_bytes big-endian bytes to limbs and back
+    Limbs<N> bytes_to_limbs(const char* bytes) const {
+        Limbs<N> x{};
+        for (std::size_t i = 0; i < block_bytes_; ++i){
+            std::size_t pos = block_bytes_ - 1 - i;
+            x[pos / 8] |= static_cast<std::uint64_t>(static_cast<unsigned char>(bytes[i])) << (8 * (pos % 8));
+        }
+        return x;
+    }
+
+    void limbs_to_bytes(const Limbs<N>& x, char* out) const {
+        for (std::size_t i = 0; i < block_bytes_; ++i){
+            std::size_t pos = block_bytes_ - 1 - i;
+            out[i] = static_cast<char>(x[pos / 8] >> (8 * (pos % 8)));
+        }
+    }
+
+    /*
+     * Decrypts every block of cipher and calls out(i, plaintext block i). Blocks are decrypted BATCH_LANES at a time
+     * in stack buffers; short messages run in one piece on this thread, longer ones in chunks of CBC_PARALLEL_GRAIN
+     * blocks on the shared pool, so out must only write state that belongs to block i.
+     */
+    template <class F>
+    void for_each_batch(std::span<const cpp_int> cipher, F&& out) const {
+        auto body = [&](std::size_t begin, std::size_t end){
+            for (std::size_t g = begin; g < end; g += BATCH_LANES){
+                std::size_t lanes = std::min(BATCH_LANES, end - g);
+                Limbs<N> blocks[BATCH_LANES];
+                for (std::size_t l = 0; l < lanes; ++l) blocks[l] = load(cipher[g + l]);
+                decrypt_blocks(blocks, blocks, lanes);
+                for (std::size_t l = 0; l < lanes; ++l) out(g + l, blocks[l]);
+            }
+        };
+        if (cipher.size() < CBC_PARALLEL_MIN_BLOCKS) body(0, cipher.size());
+        else shared_thread_pool().parallel_for(cipher.size(), CBC_PARALLEL_GRAIN, body);
+    }
+
+    // Low 8 * block_bytes bits set
+    static Limbs<N> block_mask(std::size_t block_bytes){
+        Limbs<N> mask{};
+        for (std::size_t pos = 0; pos < block_bytes; ++pos) mask[pos / 8] |= std::uint64_t(0xff) << (8 * (pos % 8));
+        return mask;
+    }
+
+    // Garner's recombination of m1 = c^dp mod p and m2 = c^dq mod q into c^d mod n
+    Limbs<N> crt_combine(const Limbs<H>& m1, const Limbs<H>& m2) const {
+        Limbs<H> m2p = m2; // m2 < q, which can be any multiple of p in size, so reduce fully when m2 is not already below p
+        if (!limbs_less(m2p, p_)){
+            Limbs<2 * H> wide{};
+            std::copy(m2.begin(), m2.end(), wide.begin());
+            m2p = field_p_.reduce_wide(wide);
+        }
+        Limbs<H> diff = m1;
+        if (limbs_sub(diff, m2p)) limbs_add(diff, p_);
+        Limbs<H> h = field_p_.mul(diff, qinv_);
+
+        Limbs<N> m = limbs_mul(h, q_);
+        Limbs<N> low{};
+        std::copy(m2.begin(), m2.end(), low.begin());
+        limbs_add(m, low);
+        return m;
+    }
+
+    // c^exp modulo one prime for a group of full-width blocks
+    static void half_pow_lanes(const MontgomeryField<H>& field, const SimdModulus& simd, const WindowedExponent& exp,
+                               const Limbs<N>* c, Limbs<H>* out, std::size_t lanes){
+        if (simd.usable){
+            std::uint64_t in[BATCH_LANES * H] = {}, res[BATCH_LANES * H];
+            for (std::size_t l = 0; l < lanes; ++l){
+                Limbs<H> r = field.reduce_wide(c[l]);
+                std::copy(r.begin(), r.end(), in + l * H);
+            }
+            simd_pow_lanes(simd, in, H, res, lanes, exp);
+            for (std::size_t l = 0; l < lanes; ++l) std::copy(res + l * H, res + (l + 1) * H, out[l].begin());
+            return;
+        }
+        Limbs<H> base[BATCH_LANES] = {};
+        for (std::size_t l = 0; l < lanes; ++l) base[l] = field.to_mont(c[l]);
+        field.template pow_lanes<BATCH_LANES>(base, out, lanes, exp);
+        for (std::size_t l = 0; l < lanes; ++l) out[l] = field.from_mont(out[l]);
+    }
+
+    // e as a single word, or 0 if it does not fit in one
+    static std::uint64_t small_exponent(const cpp_int& e){
+        return (e > 0 && msb(e) < 64) ? e.convert_to<std::uint64_t>() : 0;
+    }
+
+    // Blocks at or above n are reduced first so the result matches the reference path
+    Limbs<N> load(const cpp_int& x) const {
+        return x < n_ ? to_limbs<N>(x) : to_limbs<N>(x % n_);
+    }
+
+    cpp_int n_;
+    MontgomeryField<N> field_n_;
+    Limbs<N> e_{};
+    std::uint64_t e_small_ = 0;
+    std::size_t block_bytes_ = 0;
+    Limbs<N> mask_{};
+    MontgomeryField<H> field_p_, field_q_;
+    Limbs<H> p_{}, q_{}, qinv_{};
+    WindowedExponent dp_, dq_;
+    SimdModulus simd_p_, simd_q_;
+    bool has_private_ = false;
+};
+
+
+std::unique_ptr<RsaEngineBase> make_rsa_engine(const cpp_int& e, const cpp_int& n);
+std::unique_ptr<RsaEngineBase> make_rsa_engine(const RsaPrivateKey& key);
+CbcCodebook make_cbc_codebook(const RsaEngineBase& engine);
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ *  File: thread_pool.cpp
+ * Author: Johnny CW
+ * Date: October 16, 2026
+ * Small thread pool shared by the parts of the program that split work across cores
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(std::size_t threads){
+    workers_.reserve(threads);
+    for (std::size_t i = 0; i < threads; ++i) workers_.emplace_back([this]{ worker_loop(); });
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    ready_.notify_all();
+    for (auto& t : workers_) t.join();
+}
+
+void ThreadPool::submit(std::function<void()> task){
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    ready_.notify_one();
+}
+
+void ThreadPool::worker_loop(){
+    for (;;){
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.wait(lock, [this]{ return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) return; // stopping and drained
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+
+/*
+ * Parallel For
+ *
+ * Variables:
+ * count: number of items, indexed 0..count-1
+ * grain: items per chunk; body(begin, end) is called once per chunk
+ * next: the next chunk nobody has claimed yet
+ *
+ * Purpose:
+ * Chunks are claimed from a shared counter rather than assigned up front, so a slow chunk does not hold back the
+ * others. The calling thread claims chunks too, which means a call made from inside a pool task still finishes even
+ * when every worker is busy. Returns once every chunk is done and rethrows the first exception a chunk threw.
+ */
+void ThreadPool::parallel_for(std::size_t count, std::size_t grain,
+                              const std::function<void(std::size_t, std::size_t)>& body){
+    if (count == 0) return;
+    grain = std::max<std::size_t>(grain, 1);
+    std::size_t chunks = (count + grain - 1) / grain;
+    if (chunks == 1 || workers_.empty()){
+        body(0, count);
+        return;
+    }
+
+    struct Shared {
+        std::atomic<std::size_t> next{0};
+        std::size_t done = 0;
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    // Helpers that only get a worker after every chunk is claimed can outlive this call, so they share ownership
+    auto shared = std::make_shared<Shared>();
+
+    auto run = [shared, chunks, count, grain, &body]{
+        for (;;){
+            std::size_t chunk = shared->next.fetch_add(1);
+            if (chunk >= chunks) return;
+            std::size_t begin = chunk * grain;
+            std::size_t end = std::min(count, begin + grain);
+            std::exception_ptr error;
+            try {
+                body(begin, end);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            if (error && !shared->error) shared->error = error;
+            if (++shared->done == chunks) shared->finished.notify_all();
+        }
+    };
+
+    std::size_t helpers = std::min(workers_.size(), chunks - 1);
+    for (std::size_t i = 0; i < helpers; ++i) submit(run);
+    run();
+
+    std::unique_lock<std::mutex> lock(shared->mutex);
+    shared->finished.wait(lock, [&]{ return shared->done == chunks; });
+    if (shared->error) std::rethrow_exception(shared->error);
+}
+
+
+/*
+ * One pool for the whole process, sized to the machine and created on first use
+ */
+ThreadPool& shared_thread_pool(){
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
@@ -0,0 +1,59 @@
+/*
+ *  File: crypto_pool.cpp
+ * Author: Johnny CW
+ * Date: October 16, 2026
+ * Worker threads that decrypt received messages off the I/O thread and post the responses back
+ */
+
+#include <utility>
+#include "crypto_pool.h"
+
+CryptoPool::CryptoPool(std::size_t threads, std::function<void()> notify)
+    : jobs_(CRYPTO_QUEUE_JOBS), results_(CRYPTO_QUEUE_JOBS + threads), notify_(std::move(notify)){
+    workers_.reserve(threads);
+    for (std::size_t i = 0; i < threads; ++i) workers_.emplace_back([this](std::stop_token stop){ worker_loop(stop); });
+}
+
+CryptoPool::~CryptoPool(){
+    for (auto& t : workers_) t.request_stop();
+    queued_.release(workers_.size()); // wake every sleeping worker to see the stop
+}
+
+bool CryptoPool::try_submit(CryptoJob&& job){
+    if (!jobs_.try_push(std::move(job))) return false;
+    queued_.release();
+    return true;
+}
+
+bool CryptoPool::try_complete(CryptoResult& result){
+    return results_.try_pop(result);
+}
+
+
+/*
+ * Crypto Worker Loop
+ *
+ * Purpose:
+ * Sleeps on the semaphore until a job is queued, feeds its bytes to the session and posts what process() produced.
+ * Each release of the semaphore stands for one job, so after acquiring it a job is certain to be there, though
+ * possibly still being written by its producer; the pop is retried until it lands. The results queue holds every
+ * job the pool can have at once, so posting only waits in the same brief way.
+ */
+void CryptoPool::worker_loop(std::stop_token stop){
+    while (true){
+        queued_.acquire();
+        if (stop.stop_requested()) return;
+
+        CryptoJob job;
+        while (!jobs_.try_pop(job)) std::this_thread::yield();
+
+        CryptoResult result;
+        result.connection = job.connection;
+        job.session->feed(job.input);
+        result.ok = job.session->process(result.output);
+        job.session.reset();
+
+        while (!results_.try_push(std::move(result))) std::this_thread::yield();
+        if (!notified_.exchange(true, std::memory_order_acq_rel)) notify_();
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef CRYPTO_POOL_H
+#define CRYPTO_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <semaphore>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mpmc_queue.h"
+#include "session.h"
+
+constexpr std::size_t CRYPTO_QUEUE_JOBS = 4096; // jobs waiting for a worker before try_submit() refuses more
+
+// Bytes received on one connection, to be decrypted by its session
+struct CryptoJob {
+    std::uint64_t connection = 0;
+    std::shared_ptr<Session> session; // shared, so a connection closed mid-job does not free it under the worker
+    std::string input;
+};
+
+// What a job produced, posted back for the connection to send
+struct CryptoResult {
+    std::uint64_t connection = 0;
+    std::string output;   // responses, ready to send
+    bool ok = true;       // false if the stream cannot be read any further
+};
+
+/*
+ * Crypto Worker Pool
+ *
+ * Fixed set of threads that run the decryption so the I/O thread never does. Jobs go in through a lock-free MPMC
+ * queue and results come back through another; notify() is called after a result is posted, at most once until
+ * the owner next calls clear_notified(), so an event loop can be woken by one eventfd write however many results
+ * arrive. A session's messages are chained, so the owner submits at most one job per session at a time.
+ */
+class CryptoPool {
+public:
+    CryptoPool(std::size_t threads, std::function<void()> notify);
+    ~CryptoPool();
+
+    CryptoPool(const CryptoPool&) = delete;
+    CryptoPool& operator=(const CryptoPool&) = delete;
+
+    std::size_t size() const { return workers_.size(); }
+    bool try_submit(CryptoJob&& job);
+    bool try_complete(CryptoResult& result);
+    void clear_notified() { notified_.exchange(false, std::memory_order_acq_rel); }
+
+private:
+    void worker_loop(std::stop_token stop);
+
+    MpmcQueue<CryptoJob> jobs_;
+    MpmcQueue<CryptoResult> results_;
+    std::counting_semaphore<> queued_{0};
+    std::atomic<bool> notified_{false};
+    std::function<void()> notify_;
+    std::vector<std::jthread> workers_; // last, so the threads stop before the queues are destroyed
+};
+
+#endif
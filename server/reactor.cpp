@@ -0,0 +1,322 @@
+/*
+ *  File: reactor.cpp
+ * Author: Johnny CW
+ * Date: October 16, 2026
+ * Linux epoll event loop that serves every client connection from one thread with non-blocking sockets, handing
+ * the decryption to a pool of crypto workers
+ */
+
+#if defined __linux__
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "crypto_pool.h"
+#include "reactor.h"
+
+namespace {
+
+// epoll tokens that are not connections; connection ids start after them
+constexpr std::uint64_t LISTEN_TOKEN = 0;
+constexpr std::uint64_t WAKE_TOKEN = 1;
+
+// Where a connection is in its exchange with the client
+enum class ConnectionState {
+    SendingKey,      // the public key has not all been written yet
+    ReadingFrame,    // waiting for the rest of a message
+    Decrypting,      // a crypto worker has the connection's received bytes
+    WritingResponse, // responses are waiting for the socket to accept them
+};
+
+struct Connection {
+    Connection(std::uint64_t token, int socket, const ServerContext& ctx)
+        : id(token), fd(socket), session(std::make_shared<Session>(ctx)) {}
+
+    std::uint64_t id;
+    int fd;
+    std::shared_ptr<Session> session;
+    ConnectionState state = ConnectionState::SendingKey;
+    std::string in;               // received, not yet handed to a worker
+    std::string out;              // responses not yet sent
+    std::size_t out_sent = 0;     // bytes of out already sent
+    bool busy = false;            // a job for this connection is in the crypto pool
+    bool readable = false;        // edge-triggered, so set until recv() reports EAGAIN
+    bool peer_closed = false;
+    bool closing = false;         // the stream cannot be read further: send what is queued, then close
+    std::string name;             // host:port, for the log
+};
+
+bool set_nonblocking(int fd){
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+bool can_read(const Connection& conn){
+    return conn.readable && !conn.closing && conn.in.size() < REACTOR_MAX_PENDING_IN && conn.out.size() - conn.out_sent < REACTOR_MAX_PENDING_OUT;
+}
+
+/*
+ * Write Pending Output
+ *
+ * Purpose:
+ * Sends as much of the connection's queued output as the socket takes without blocking. Returns false if the
+ * connection failed; otherwise the rest, if any, is sent when epoll reports the socket writable again.
+ */
+bool write_pending(Connection& conn){
+    while (conn.out_sent < conn.out.size()){
+        ssize_t n = send(conn.fd, conn.out.data() + conn.out_sent, conn.out.size() - conn.out_sent, MSG_NOSIGNAL);
+        if (n > 0){
+            conn.out_sent += n;
+        } else if (n < 0 && errno == EINTR){
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            return true;
+        } else {
+            std::cerr << "send failed: " << strerror(errno) << "\n";
+            return false;
+        }
+    }
+    conn.out.clear();
+    conn.out_sent = 0;
+    if (conn.state == ConnectionState::SendingKey || conn.state == ConnectionState::WritingResponse){
+        conn.state = conn.busy ? ConnectionState::Decrypting : ConnectionState::ReadingFrame;
+    }
+    return true;
+}
+
+/*
+ * Read Available Input
+ *
+ * Purpose:
+ * Drains the socket until recv() reports EAGAIN, as edge-triggered epoll requires, collecting the bytes for the
+ * next crypto job. Reading pauses while REACTOR_MAX_PENDING_IN bytes wait for a worker or REACTOR_MAX_PENDING_OUT
+ * bytes of responses are unsent, so a client cannot make the server buffer without bound; readable stays set and
+ * reading resumes once the backlog clears. Returns false if the connection failed.
+ */
+bool read_available(Connection& conn, char* buffer){
+    while (can_read(conn)){
+        ssize_t n = recv(conn.fd, buffer, REACTOR_READ_BYTES, 0);
+        if (n > 0){
+            conn.in.append(buffer, n);
+        } else if (n == 0){
+            conn.readable = false;
+            conn.peer_closed = true;
+        } else if (errno == EINTR){
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK){
+            conn.readable = false;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+
+/*
+ * Epoll Server Loop
+ *
+ * Variables:
+ * listen_socket - bound, listening server socket; made non-blocking here
+ * ctx - engine, decrypt index and public key shared by every connection
+ * crypto_threads - crypto worker threads, 0 for one per core
+ *
+ * Purpose:
+ * Serves all clients from one I/O thread. Each accepted socket is non-blocking and registered edge-triggered for
+ * input and output under its connection id, so a wakeup costs nothing per idle client and thousands of connections
+ * can stay open at once. A connection moves from sending the public key, to reading a frame, to decrypting it and
+ * to writing the response, only ever doing the work its socket is ready for.
+ *
+ * The I/O thread never decrypts: received bytes go to the crypto pool as a job, one per connection at a time since
+ * its messages are chained, and bytes that arrive meanwhile wait for the next job. Workers post the responses back
+ * and wake the loop through an eventfd, and the loop sends them on the owning connection, if it is still open.
+ * A long message therefore delays only its own connection, and decrypt throughput grows with the worker count.
+ * Returns only if epoll itself fails.
+ */
+int run_epoll_server(int listen_socket, const ServerContext& ctx, unsigned crypto_threads){
+    if (!set_nonblocking(listen_socket)){
+        std::cerr << "fcntl failed: " << strerror(errno) << "\n";
+        return 1;
+    }
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    int wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epfd < 0 || wakefd < 0){
+        std::cerr << "epoll_create1/eventfd failed: " << strerror(errno) << "\n";
+        if (epfd >= 0) close(epfd);
+        if (wakefd >= 0) close(wakefd);
+        return 1;
+    }
+    struct epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = LISTEN_TOKEN;
+    struct epoll_event wev{};
+    wev.events = EPOLLIN;
+    wev.data.u64 = WAKE_TOKEN;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listen_socket, &ev) != 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &wev) != 0){
+        std::cerr << "epoll_ctl failed: " << strerror(errno) << "\n";
+        close(wakefd);
+        close(epfd);
+        return 1;
+    }
+
+    if (crypto_threads == 0) crypto_threads = std::max(1u, std::thread::hardware_concurrency());
+    auto pool = std::make_unique<CryptoPool>(crypto_threads, [wakefd]{
+        std::uint64_t one = 1;
+        if (write(wakefd, &one, sizeof(one)) < 0) {} // only fails if the counter is already huge, and then it is readable
+    });
+    log_line("Serving clients with epoll, " + std::to_string(pool->size()) + " crypto worker threads");
+
+    std::unordered_map<std::uint64_t, std::unique_ptr<Connection>> connections;
+    std::uint64_t next_id = WAKE_TOKEN + 1;
+    std::vector<std::uint64_t> stalled; // connections whose job found the crypto queue full
+
+    auto close_connection = [&](Connection& conn){
+        log_line("Client disconnected: " + conn.name);
+        epoll_ctl(epfd, EPOLL_CTL_DEL, conn.fd, nullptr);
+        close(conn.fd);
+        connections.erase(conn.id); // destroys conn; a job still in the pool keeps the session alive
+    };
+
+    //Hand the bytes received so far to a worker, unless the connection already has a job there
+    auto submit = [&](Connection& conn){
+        if (conn.busy || conn.closing || conn.in.empty()) return;
+        CryptoJob job{conn.id, conn.session, std::move(conn.in)};
+        conn.in.clear();
+        if (pool->try_submit(std::move(job))){
+            conn.busy = true;
+            if (conn.state == ConnectionState::ReadingFrame) conn.state = ConnectionState::Decrypting;
+        } else {
+            conn.in = std::move(job.input);
+            stalled.push_back(conn.id);
+        }
+    };
+
+    //Do whatever the connection's sockets and queues allow, and close it if it is finished or failed
+    std::unique_ptr<char[]> buffer(new char[REACTOR_READ_BYTES]);
+    auto service = [&](Connection& conn, bool failed){
+        bool ok = !failed && write_pending(conn);
+        while (ok && can_read(conn)){
+            ok = read_available(conn, buffer.get());
+            submit(conn);
+        }
+        bool finished = conn.closing ? conn.out.empty() : conn.peer_closed && !conn.busy && conn.in.empty() && conn.out.empty();
+        if (!ok || finished) close_connection(conn);
+    };
+
+    auto accept_clients = [&]{
+        while (true){
+            struct sockaddr_storage clientAddress;
+            socklen_t addrlen = sizeof(clientAddress);
+            int ns = accept4(listen_socket, (struct sockaddr *)&clientAddress, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (ns < 0){
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) std::cerr << "accept failed: " << strerror(errno) << "\n";
+                return;
+            }
+
+            auto conn = std::make_unique<Connection>(next_id++, ns, ctx);
+            char clientHost[NI_MAXHOST], clientService[NI_MAXSERV];
+            if (getnameinfo((struct sockaddr *)&clientAddress, addrlen, clientHost, sizeof(clientHost), clientService,
+                            sizeof(clientService), NI_NUMERICHOST | NI_NUMERICSERV) == 0){
+                conn->name = std::string(clientHost) + ":" + clientService;
+            }
+            log_line("Client connected: " + conn->name);
+
+            struct epoll_event cev{};
+            cev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            cev.data.u64 = conn->id;
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, ns, &cev) != 0){
+                std::cerr << "epoll_ctl failed: " << strerror(errno) << "\n";
+                close(ns);
+                continue;
+            }
+
+            //Send the public key; whatever the socket does not take now goes out on EPOLLOUT
+            conn->out = ctx.public_key;
+            Connection& c = *conn;
+            connections.emplace(c.id, std::move(conn));
+            service(c, false);
+        }
+    };
+
+    //Take the workers' results to their connections, then retry jobs that found the queue full
+    auto collect_results = [&]{
+        std::uint64_t count;
+        if (read(wakefd, &count, sizeof(count)) < 0) {} // EAGAIN when a previous pass already took the results
+        pool->clear_notified();
+
+        CryptoResult result;
+        while (pool->try_complete(result)){
+            auto it = connections.find(result.connection);
+            if (it == connections.end()) continue; // closed while its job ran
+            Connection& conn = *it->second;
+            conn.busy = false;
+            conn.out += result.output;
+            if (conn.state == ConnectionState::Decrypting){
+                conn.state = conn.out.empty() ? ConnectionState::ReadingFrame : ConnectionState::WritingResponse;
+            }
+            //Responses to the messages before a protocol error still go out before the connection closes
+            if (result.ok) submit(conn);
+            else conn.closing = true;
+            service(conn, false);
+        }
+
+        std::vector<std::uint64_t> retry;
+        retry.swap(stalled);
+        for (std::uint64_t id : retry){
+            auto it = connections.find(id);
+            if (it != connections.end()) submit(*it->second);
+        }
+    };
+
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    while (true){
+        int ready = epoll_wait(epfd, events, REACTOR_MAX_EVENTS, -1);
+        if (ready < 0){
+            if (errno == EINTR) continue;
+            std::cerr << "epoll_wait failed: " << strerror(errno) << "\n";
+            break;
+        }
+
+        for (int i = 0; i < ready; ++i){
+            std::uint64_t token = events[i].data.u64;
+            if (token == LISTEN_TOKEN){
+                accept_clients();
+                continue;
+            }
+            if (token == WAKE_TOKEN){
+                collect_results();
+                continue;
+            }
+
+            auto it = connections.find(token);
+            if (it == connections.end()) continue; // closed earlier in this batch
+            Connection& conn = *it->second;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) conn.readable = true;
+            service(conn, events[i].events & EPOLLERR);
+        }
+    }
+
+    pool.reset(); // workers may still post a result and write to wakefd until they have stopped
+    for (auto& [id, conn] : connections) close(conn->fd);
+    close(wakefd);
+    close(epfd);
+    return 1;
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <cstddef>
+#include "session.h"
+
+#if defined __linux__
+constexpr int REACTOR_MAX_EVENTS = 256;                      // epoll events handled per wakeup
+constexpr std::size_t REACTOR_READ_BYTES = 65536;            // bytes read per recv()
+constexpr std::size_t REACTOR_MAX_PENDING_IN = 1 << 20;      // received bytes waiting for a crypto worker before a connection stops being read
+constexpr std::size_t REACTOR_MAX_PENDING_OUT = 1 << 20;     // unsent response bytes before a connection stops being read
+
+int run_epoll_server(int listen_socket, const ServerContext& ctx, unsigned crypto_threads = 0);
+#endif
+
+#endif
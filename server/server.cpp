@@ -7,6 +7,9 @@
  */
 
 #define USE_IPV6 true
+#define USE_DECRYPT_INDEX false //Decrypt byte-mode blocks by reverse lookup instead of RSA
+#define USE_EPOLL true //Serve all clients from one epoll loop on Linux instead of one at a time
+#define CRYPTO_THREADS 0 //Worker threads that decrypt for the epoll loop; 0 for one per core
 
 #if defined _WIN32
 #include <winsock2.h>
@@ -30,14 +33,21 @@ WSADATA wsadata;
 #include <boost/multiprecision/cpp_int.hpp>
 #include <vector>
 #include <string>
-#include <sstream>
+#include <cstring>
 #include "rsa_cbc.h"
+#include "rsa_engine.h"
+#include "protocol.h"
+#include "envelope.h"
+#include "key_store.h"
+#include "session.h"
+#include "reactor.h"
 
 using namespace boost::multiprecision;
 using std::cout;
 
 #define DEFAULT_PORT "1234"
-#define BUFFER_SIZE 65536 //64KB or 200-300 characters
+#define KEY_FILE "server_key.rsak"
+#define BUFFER_SIZE 65536 //bytes read per recv(); messages may be any length
 
 
 
@@ -56,15 +66,52 @@ int main(int argc, char *argv[]) {
 
  cout << "\n<<<RSA-CBC TCP Server>>>\n";
  cout << "IPv6 mode: " << (USE_IPV6 ? "enabled" : "disabled") << "\n";
+ cout << "Decrypt index: " << (USE_DECRYPT_INDEX ? "enabled" : "disabled") << "\n";
+#if defined __linux__
+ cout << "Epoll: " << (USE_EPOLL ? "enabled" : "disabled") << "\n";
+#endif
+
+ //Arguments: [port] [--rotate-key], in any order; the port is the first argument that is not a flag
+ bool rotate_key = false;
+ const char *port_arg = nullptr;
+ for (int i = 1; i < argc; ++i) {
+  if (strcmp(argv[i], "--rotate-key") == 0) rotate_key = true;
+  else if (argv[i][0] == '-') cout << "Ignoring unknown option: " << argv[i] << "\n";
+  else if (!port_arg) port_arg = argv[i];
+ }
 
- //Generate RSA Keys
+ //Load the RSA key from the key file, or generate and save one (--rotate-key forces a new key)
  int bits = 512;
- cpp_int n, e, d;
- generate_rsa_keys(n, e, d, bits);
- cout << "Generated RSA keys:\n";
- cout << "n: " << n << "\n";
- cout << "e: " << e << "\n";
- cout << "d: " << d << "\n";
+ RsaPrivateKey key;
+ KeySource source = load_or_generate_rsa_key(KEY_FILE, bits, rotate_key, key);
+ if (source == KeySource::Loaded) cout << "Loaded RSA keys from " << KEY_FILE << ":\n";
+ else if (source == KeySource::Pregenerated) cout << "Rotated to the pre-generated RSA keys from " << next_key_path(KEY_FILE) << ":\n";
+ else if (source == KeySource::Generated) cout << "Generated RSA keys, saved to " << KEY_FILE << ":\n";
+ else cout << "Generated RSA keys (could not write " << KEY_FILE << "):\n";
+ cout << "n: " << key.n << "\n";
+ cout << "e: " << key.e << "\n";
+ cout << "d: " << key.d << "\n";
+
+ //Pick the fixed-width engine for this key size
+ std::unique_ptr<RsaEngineBase> engine = make_rsa_engine(key);
+ if (!engine) {
+  std::cerr << "RSA key too small to encrypt with\n";
+#if defined _WIN32
+  WSACleanup();
+#endif
+  return 1;
+ }
+ cout << "Using " << engine->bits() << "-bit RSA engine\n";
+
+ //Reverse-lookup index of the 256 byte-mode ciphertexts, built once per key
+ CbcDecryptIndex decrypt_index;
+ if (USE_DECRYPT_INDEX) {
+  decrypt_index = make_cbc_decrypt_index(make_cbc_codebook(*engine));
+ }
+
+ //Generate the key the next --rotate-key switches to on a low-priority background thread, so rotating is instant
+ std::jthread next_key = pregenerate_next_rsa_key(KEY_FILE, bits);
+ if (next_key.joinable()) cout << "Pre-generating the next RSA key in the background (" << next_key_path(KEY_FILE) << ")\n";
 
  //Servers address
  struct addrinfo hints, *result = nullptr;
@@ -75,8 +122,8 @@ int main(int argc, char *argv[]) {
  hints.ai_flags = AI_PASSIVE;
 
  char portNum[12];
- if (argc==2) {
-  strncpy(portNum, argv[1], sizeof(portNum) - 1);
+ if (port_arg) {
+  strncpy(portNum, port_arg, sizeof(portNum) - 1);
   portNum[sizeof(portNum) - 1] = '\0';
  }else {
   strncpy(portNum, DEFAULT_PORT, sizeof(portNum) - 1);
@@ -125,7 +172,11 @@ int main(int argc, char *argv[]) {
 
  //Listen
  if (listen(s, SOMAXCONN) != 0) {
+#if defined _WIN32
   std::cerr << "listen failed: " << WSAGetLastError() << "\n";
+#else
+  std::cerr << "listen failed: " << strerror(errno) << "\n";
+#endif
   freeaddrinfo(result);
 #if defined _WIN32
   closesocket(s);
@@ -139,6 +190,21 @@ int main(int argc, char *argv[]) {
  cout << "Server is listening on port " << portNum << "...\n";
  freeaddrinfo(result);
 
+ //Everything the connections share: the engine, the decrypt index, the public key (e|n) and the modes and formats
+ //sent to clients that ask for them
+ ServerContext ctx{*engine, USE_DECRYPT_INDEX ? &decrypt_index : nullptr, debug_mode, format_public_key(key.e, key.n),
+                   format_capabilities({CbcMode::Byte, CbcMode::Packed, CbcMode::Segmented, CbcMode::Envelope},
+                                       {WireFormat::Text, WireFormat::Binary})};
+
+#if defined __linux__
+ if (USE_EPOLL) {
+  int status = run_epoll_server(s, ctx, CRYPTO_THREADS);
+  close(s);
+  return status;
+ }
+#endif
+
+ //One client at a time where epoll is not available
  while (true){
   struct sockaddr_storage clientAddress;
   socklen_t addrlen = sizeof(clientAddress);
@@ -161,11 +227,14 @@ int main(int argc, char *argv[]) {
   getnameinfo((struct sockaddr *)&clientAddress, addrlen, clientHost, sizeof(clientHost), clientService, sizeof(clientService), NI_NUMERICSERV);
   cout << "Client connected: " << clientHost << ":" << clientService << "\n";
 
-  //Send the public key (e|n) to the client
-  std::string public_key = e.str() + "|" + n.str();
-  int bytes = send(ns, public_key.c_str(), public_key.size(), 0);
+  //Send the public key to the client
+  int bytes = send(ns, ctx.public_key.c_str(), ctx.public_key.size(), 0);
   if (bytes <= 0){
+#if defined _WIN32
    std::cerr << "send public key failed: " << WSAGetLastError() << "\n";
+#else
+   std::cerr << "send public key failed: " << strerror(errno) << "\n";
+#endif
 #if defined _WIN32
    closesocket(ns);
 #else
@@ -174,73 +243,35 @@ int main(int argc, char *argv[]) {
    continue;
   }
 
-  //Handling messages from the same client
-  while (true) {
+  //Handling messages from the same client. The session reassembles messages from whatever recv() returns and
+  //decrypts each block by block as it arrives, so its length is not limited by the buffer
+  Session session(ctx);
+  std::string response;
+  bool connected = true;
+  while (connected) {
    char buffer[BUFFER_SIZE];
-   memset(buffer, 0, BUFFER_SIZE);
-   bytes = recv(ns, buffer, BUFFER_SIZE-1, 0);
+   bytes = recv(ns, buffer, BUFFER_SIZE, 0);
    if (bytes <= 0) {
     std::cout << "Client disconnected\n";
     break;
    }
-   buffer[bytes] = '\0';
-
-   // Debug: Show raw received data
-   if (debug_mode){
-    cout << "[DEBUG] Received data: " << buffer << std::endl;
-   }
-
-   std::string data(buffer);
-   size_t delimiter_pos = data.find('|');
-   if (delimiter_pos == std::string::npos) {
-    cout << "Invalid data format.\n";
-    continue;
-   }
-
-   std::string encrypted_nonce_str = data.substr(0, delimiter_pos);
-   std::string cipher_str = data.substr(delimiter_pos + 1);
-
-   // Debug: Show encrypted nonce and ciphertext
-   if (debug_mode) {
-    cout << "[DEBUG] Encrypted nonce: " << encrypted_nonce_str << std::endl;
-    cout << "[DEBUG] Ciphertext blocks: " << cipher_str << std::endl;
-   }
-
-   //Decrypt Nonce to use it as the IV
-   cpp_int encrypted_nonce(encrypted_nonce_str);
-   cpp_int iv = rsa_decrypt(encrypted_nonce, d, n);
-
-   // Debug: Show decrypted IV
-   if (debug_mode) {
-    cout << "[DEBUG] Decrypted IV: " << iv << std::endl;
-   }
-
-
-   //Parse the ciphertext blocks
-   std::vector<cpp_int> cipher;
-   std::stringstream ss(cipher_str);
-   std::string block;
-   while (getline(ss, block, ',')) {
-    if (!block.empty()) {
-     cipher.push_back(cpp_int(block));
+   session.feed(std::string_view(buffer, bytes));
+   response.clear();
+   connected = session.process(response);
+
+   //Send Responses to the client
+   for (std::size_t sent = 0; sent < response.size();) {
+    int n = send(ns, response.c_str() + sent, response.size() - sent, 0);
+    if (n <= 0) {
+#if defined _WIN32
+     std::cerr << "send failed: " << WSAGetLastError() << "\n";
+#else
+     std::cerr << "send failed: " << strerror(errno) << "\n";
+#endif
+     connected = false;
+     break;
     }
-   }
-
-   // Debug: Show number of parsed blocks
-   if (debug_mode) {
-    cout << "[DEBUG] Parsed " << cipher.size() << " ciphertext blocks." << std::endl;
-   }
-
-   //Decrypt Message Blocks
-   std::string decrypted_message = cbc_decrypt(cipher, d, n, iv);
-   std::cout << "Decrypted message: " << decrypted_message << std::endl;
-
-   //Send Response to the client
-   std::string response = "Message received: " + decrypted_message + "\r\n";
-   bytes = send(ns, response.c_str(), response.size(), 0);
-   if(bytes <= 0) {
-    std::cerr << "send failed: " << WSAGetLastError() << "\n";
-    break;
+    sent += n;
    }
   }
 
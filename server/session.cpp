@@ -0,0 +1,119 @@
+/*
+ *  File: session.cpp
+ * Author: Johnny CW
+ * Date: October 16, 2026
+ * Per-connection protocol state of the server: frames in, decrypted messages and responses out
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include "session.h"
+
+//Writes one line to stdout; sessions run on several threads, so lines are written whole
+void log_line(const std::string& line){
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::cout << line << std::endl;
+}
+
+
+/*
+ * Process Received Frames
+ *
+ * Purpose:
+ * Handles every frame event the bytes fed so far complete. Binary messages are decrypted a chunk at a time as their
+ * blocks arrive; a text message is parsed and decrypted whole, and a capability request is answered. Returns
+ * false if the stream cannot be read any further (the caller should close the connection); a text message that
+ * does not parse is only reported.
+ */
+bool Session::process(std::string& out){
+    for (FrameEvent event = reader_.next(); ; event = reader_.next()){
+        if (event == FrameEvent::NeedMore && !framed_) event = reader_.flush();
+        if (event == FrameEvent::NeedMore) return true;
+
+        if (event == FrameEvent::Text){
+            // Debug: Show raw received data
+            if (ctx_.debug) log_line("[DEBUG] Received data: " + std::string(reader_.text()));
+            if (reader_.text() == CAPABILITY_REQUEST){
+                framed_ = true;
+                out += ctx_.capabilities;
+                out += "\r\n";
+                continue;
+            }
+            CbcMode mode;
+            cpp_int encrypted_nonce;
+            std::vector<cpp_int> cipher;
+            if (!parse_message(std::string(reader_.text()), mode, encrypted_nonce, cipher) || mode > CbcMode::Envelope){
+                log_line("Invalid data format.");
+                continue;
+            }
+            // Debug: Show number of parsed blocks
+            if (ctx_.debug) log_line("[DEBUG] Parsed " + std::to_string(cipher.size()) + " ciphertext blocks.");
+            begin_message(mode, encrypted_nonce);
+            add_blocks(cipher);
+            end_message(out);
+        } else if (event == FrameEvent::Begin){
+            framed_ = true;
+            if (ctx_.debug) log_line("[DEBUG] Receiving binary message of " + std::to_string(reader_.header().block_count) + " blocks");
+            if (reader_.header().mode > CbcMode::Envelope){
+                log_line("Invalid data format.");
+                return false;
+            }
+            begin_message(reader_.header().mode, reader_.nonce());
+        } else if (event == FrameEvent::Blocks){
+            add_blocks(reader_.blocks());
+        } else if (event == FrameEvent::End){
+            end_message(out);
+        } else {
+            log_line("Invalid data format.");
+            return false;
+        }
+    }
+}
+
+void Session::begin_message(CbcMode mode, const cpp_int& encrypted_nonce){
+    // Debug: Show mode and encrypted nonce
+    if (ctx_.debug){
+        log_line(std::string("[DEBUG] Mode: ") + (mode == CbcMode::Envelope ? "envelope" : mode == CbcMode::Segmented ? "segmented"
+                                                  : mode == CbcMode::Packed ? "packed" : "byte"));
+        log_line("[DEBUG] Encrypted nonce: " + encrypted_nonce.str());
+    }
+
+    //Decrypt Nonce to use it as the IV
+    cpp_int iv = ctx_.engine.decrypt(encrypted_nonce);
+
+    // Debug: Show decrypted IV
+    if (ctx_.debug) log_line("[DEBUG] Decrypted IV: " + iv.str());
+
+    decryptor_.emplace(ctx_.engine, mode, iv, ctx_.index);
+    mode_ = mode;
+    echo_.clear();
+    message_bytes_ = 0;
+}
+
+//Decrypt Message Blocks, keeping the first MAX_ECHO_BYTES of plaintext for the response
+void Session::add_blocks(std::span<const cpp_int> blocks){
+    std::string plaintext = decryptor_->update(blocks);
+    echo_.append(plaintext, 0, MAX_ECHO_BYTES - std::min(echo_.size(), MAX_ECHO_BYTES));
+    message_bytes_ += plaintext.size();
+}
+
+//Finish the message and append the response for the client
+void Session::end_message(std::string& out){
+    std::string tail;
+    bool valid = decryptor_->finish(tail);
+    decryptor_.reset();
+    echo_.append(tail, 0, MAX_ECHO_BYTES - std::min(echo_.size(), MAX_ECHO_BYTES));
+    message_bytes_ += tail.size();
+    if (!valid) echo_.clear();
+
+    std::string summary = echo_;
+    if (valid && message_bytes_ > echo_.size()) summary += "... (" + std::to_string(message_bytes_) + " bytes)";
+    log_line("Decrypted message: " + summary + (valid ? "" : " [invalid padding]"));
+
+    out += "Message received: ";
+    out += summary;
+    out += "\r\n";
+}
@@ -0,0 +1,60 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <boost/multiprecision/cpp_int.hpp>
+#include "cbc_stream.h"
+#include "framing.h"
+#include "rsa_cbc.h"
+#include "rsa_engine.h"
+
+using namespace boost::multiprecision;
+
+constexpr std::size_t MAX_ECHO_BYTES = 4096; // plaintext bytes repeated back in the response
+
+// Everything a session needs from the server, shared by all connections
+struct ServerContext {
+    const RsaEngineBase& engine;
+    const CbcDecryptIndex* index; // null unless byte mode decrypts by reverse lookup
+    bool debug;
+    std::string public_key;       // announcement sent to every client as it connects
+    std::string capabilities;     // answer to CAPABILITY_REQUEST
+};
+
+/*
+ * Client Session
+ *
+ * The protocol state of one connection: the frame reader, the decryptor of the message being received and the
+ * start of its plaintext for the response. It knows nothing about sockets, so the blocking loop and the epoll
+ * reactor both drive it: feed() what was received, then process() appends the response to every message completed.
+ * A client that never sends the capability request or a binary message speaks the original protocol, one message
+ * per send() without a newline, so only for it does a read that ends mid-frame end the frame.
+ */
+class Session {
+public:
+    explicit Session(const ServerContext& ctx) : ctx_(ctx) {}
+
+    void feed(std::string_view bytes) { reader_.feed(bytes); }
+    bool process(std::string& out);
+
+private:
+    void begin_message(CbcMode mode, const cpp_int& encrypted_nonce);
+    void add_blocks(std::span<const cpp_int> blocks);
+    void end_message(std::string& out);
+
+    const ServerContext& ctx_;
+    FrameReader reader_;
+    std::optional<CbcDecryptor> decryptor_;
+    CbcMode mode_ = CbcMode::Byte;
+    std::string echo_;              // start of the plaintext, for the response
+    std::size_t message_bytes_ = 0;
+    bool framed_ = false;           // the client asked for capabilities or sent binary, so every text frame ends with '\n'
+};
+
+void log_line(const std::string& line);
+
+#endif